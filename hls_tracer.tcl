@@ -10,6 +10,15 @@
 # - HLS_TRACER_USER_TB:      The C/C++ testbench code to be added
 # - HLS_TRACER_TOP_FUNCTION: The name of the top-level function
 #
+# Optionally, HLS_TRACER_SITE_TABLE sets where the tracer pass writes the
+# site table (trace record ID to source location). The testbench reads the
+# same variable to decode the trace. HLS_TRACER_PASS_FLAGS holds extra
+# options for the tracer pass, e.g. "-controlflowtrace-mode=loops".
+# If HLS_TRACER_TEMPLATED is set, the templated tracer is linked instead of
+# the plain one. Otherwise, the plain tracer is rebuilt with the features
+# that the pass options and the user code need, together with the build
+# options in TRACER_FLAGS.
+#
 # Usage:
 #   vitis_hls -f hls_tracer.tcl
 #
@@ -25,10 +34,53 @@ if { ![file exists $::HLS_LLVM_PLUGIN_DIR/control-flow-trace-pass.so] } {
   error "Must build control-flow-trace-pass.so before running this script"
 }
 
+# Extra options for the tracer pass
+set ::HLS_TRACER_PASS_FLAGS ""
+if { [info exists ::env(HLS_TRACER_PASS_FLAGS)] } {
+  set ::HLS_TRACER_PASS_FLAGS $::env(HLS_TRACER_PASS_FLAGS)
+}
+
+# Features of the plain tracer that only some runs need, so that the others
+# do not carry their state. The pass finds dataflow processes on its own, so
+# they are looked for in the user code.
+set ::HLS_TRACER_FEATURES {}
+if { [regexp -- {-controlflowtrace-(mode=edges|histogram)} $::HLS_TRACER_PASS_FLAGS] } {
+  lappend ::HLS_TRACER_FEATURES -DCONTROL_FLOW_TRACER_COUNTERS
+}
+if { [string match *-controlflowtrace-hierarchical* $::HLS_TRACER_PASS_FLAGS] } {
+  lappend ::HLS_TRACER_FEATURES -DCONTROL_FLOW_TRACER_HIERARCHICAL
+}
+if { [string match *-controlflowtrace-pack-sites* $::HLS_TRACER_PASS_FLAGS] } {
+  lappend ::HLS_TRACER_FEATURES -DCONTROL_FLOW_TRACER_PACKED
+}
+if { [string match *-controlflowtrace-signature* $::HLS_TRACER_PASS_FLAGS] } {
+  lappend ::HLS_TRACER_FEATURES -DCONTROL_FLOW_TRACER_SIGNATURE
+}
+set user_code [open $::env(HLS_TRACER_USER_CODE)]
+if { [regexp -nocase {pragma\s+HLS\s+dataflow} [read $user_code]] } {
+  lappend ::HLS_TRACER_FEATURES -DCONTROL_FLOW_TRACER_CHANNELS
+}
+close $user_code
+
+# The plain tracer, or the templated one instantiated for the trace array size
+set ::HLS_TRACER_RUNTIME control-flow-tracer.bc
+if { [info exists ::env(HLS_TRACER_TEMPLATED)] } {
+  set ::HLS_TRACER_RUNTIME control-flow-tracer-template.bc
+} elseif { [llength $::HLS_TRACER_FEATURES] > 0 } {
+  set tracer_flags {}
+  if { [info exists ::env(TRACER_FLAGS)] } {
+    set tracer_flags $::env(TRACER_FLAGS)
+  }
+  set ::HLS_TRACER_RUNTIME control-flow-tracer-features.bc
+  exec $::env(XILINX_HLS)/lnx64/tools/clang-3.9-csynth/bin/clang {*}$tracer_flags {*}$::HLS_TRACER_FEATURES \
+    -c -emit-llvm $::HLS_LLVM_TRACER_DIR/control-flow-tracer.c -o $::HLS_LLVM_TRACER_DIR/$::HLS_TRACER_RUNTIME
+  puts "Built the tracer with $::HLS_TRACER_FEATURES"
+}
+
 # Include our tracer pass to the Vitis workflow
 # Do Yoon: inject llvm-link call in LLVM custom command to inject our tracer modules into the given code.
-set ::LLVM_CUSTOM_CMD {[exec llvm-link -suppress-warnings $LLVM_CUSTOM_INPUT $::HLS_LLVM_TRACER_DIR/control-flow-tracer.bc -o $LLVM_CUSTOM_INPUT > /dev/null]}
-append ::LLVM_CUSTOM_CMD {$LLVM_CUSTOM_OPT -load $::HLS_LLVM_PLUGIN_DIR/control-flow-trace-pass.so -controlflowtrace $LLVM_CUSTOM_INPUT -o $LLVM_CUSTOM_OUTPUT}
+set ::LLVM_CUSTOM_CMD {[exec llvm-link -suppress-warnings $LLVM_CUSTOM_INPUT $::HLS_LLVM_TRACER_DIR/$::HLS_TRACER_RUNTIME $::HLS_LLVM_TRACER_DIR/control-flow-tracer-stream.bc $::HLS_LLVM_TRACER_DIR/control-flow-tracer-wide.bc -o $LLVM_CUSTOM_INPUT > /dev/null]}
+append ::LLVM_CUSTOM_CMD {$LLVM_CUSTOM_OPT -load $::HLS_LLVM_PLUGIN_DIR/control-flow-trace-pass.so -controlflowtrace $::HLS_TRACER_PASS_FLAGS $LLVM_CUSTOM_INPUT -o $LLVM_CUSTOM_OUTPUT}
 
 # Open a project and remove any existing data
 open_project -reset proj
@@ -1,9 +1,14 @@
 #include <algorithm>
+#include <cstdint>
 #include <cstdlib>
+#include <functional>
 #include <map>
+#include <set>
 #include <string>
 #include <utility>
 #include <vector>
+#include "../tracer/control-flow-trace-format.h"
+#include "llvm/Analysis/LoopInfo.h"
 #include "llvm/IR/CFG.h"
 #include "llvm/IR/DebugInfoMetadata.h"
 #include "llvm/IR/Function.h"
@@ -12,7 +17,10 @@
 #include "llvm/IR/Module.h"
 #include "llvm/Pass.h"
 #include "llvm/Support/Casting.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
 
 using namespace llvm;
 
@@ -21,9 +29,263 @@ namespace {
 enum class TracerFunction : int {
   Init,
   Record,
+  RecordTrip,
+  RecordPath,
+  RecordBranch,
+  FlushBranches,
+  RecordPacked,
+  RecordTarget,
+  RecordCall,
+  RecordReturn,
+  ClearCounters,
+  Count,
+  FlushCounters,
+  FlushHistogram,
+  InitDetail,
+  OpenWindow,
+  RecordDetail,
+  FinishDetail,
+  SetSamplePeriod,
+  Enable,
+  Enter,
+  StartClock,
+  Stamp,
+  InitChannels,
+  ChannelRecord,
+  ChannelStamp,
+  ChannelFinish,
+  StreamRecord,
+  StreamStartClock,
+  StreamStamp,
+  StreamFinish,
+  WideInit,
+  WideRecord,
+  WideStartClock,
+  WideStamp,
+  WideFinish,
+  InitSignature,
+  Fold,
+  FinishSignature,
   Finish,
 };
 
+// What the instrumentation records.
+enum class TraceMode : int {
+  // One site record per successor of every conditional branch.
+  Blocks,
+  // Like Blocks, but loops are recorded with one site record on entry and one
+  // trip count record on exit instead of records for every iteration.
+  Loops,
+  // Ball-Larus path profiling. One path record per completed acyclic path.
+  Paths,
+  // Edge profiling. Counters on a minimal set of edges, copied out at finish.
+  Edges,
+  // One bit per conditional branch outcome, one target record per switch, and
+  // one site record per function entry, replayed over the exported CFGs.
+  Branches,
+};
+
+static cl::opt<TraceMode> traceMode(
+    "controlflowtrace-mode", cl::desc("Control flow trace instrumentation mode"),
+    cl::values(clEnumValN(TraceMode::Blocks, "blocks",
+                          "Record the successors of conditional branches"),
+               clEnumValN(TraceMode::Loops, "loops",
+                          "Record loop entries and trip counts instead of loop iterations"),
+               clEnumValN(TraceMode::Paths, "paths",
+                          "Record Ball-Larus path IDs of acyclic paths"),
+               clEnumValN(TraceMode::Edges, "edges",
+                          "Count executions of a minimal set of CFG edges"),
+               clEnumValN(TraceMode::Branches, "branches",
+                          "Record branch outcomes as bits and switch targets")),
+    cl::init(TraceMode::Blocks));
+
+// Which loops record the outcomes of their branches as bits, instead of
+// writing site records in every iteration, to keep their initiation interval.
+enum class PipelinedLoops : int {
+  None,
+  // Innermost loops with '#pragma HLS pipeline'.
+  Marked,
+  // All innermost loops, which Vitis HLS pipelines automatically.
+  Innermost,
+};
+
+static cl::opt<PipelinedLoops> pipelinedLoops(
+    "controlflowtrace-pipelined-loops",
+    cl::desc("Loops whose branches are recorded as bits in blocks and loops mode"),
+    cl::values(clEnumValN(PipelinedLoops::None, "none", "No loops"),
+               clEnumValN(PipelinedLoops::Marked, "marked",
+                          "Innermost loops marked with '#pragma HLS pipeline'"),
+               clEnumValN(PipelinedLoops::Innermost, "innermost",
+                          "All innermost loops")),
+    cl::init(PipelinedLoops::Marked));
+
+static cl::opt<unsigned> maxCounters(
+    "controlflowtrace-max-counters",
+    cl::desc("Size of the tracer's on-chip counter array in edges mode "
+             "(CONTROL_FLOW_TRACER_MAX_COUNTERS)"),
+    cl::init(256));
+
+static cl::opt<std::string> clockArgName(
+    "controlflowtrace-clock",
+    cl::desc("Name of the argument that points to a free-running cycle "
+             "counter. Records in functions with this argument are stamped."),
+    cl::init("trace_clock"));
+
+static cl::opt<std::string> samplePeriodArgName(
+    "controlflowtrace-sample-period-arg",
+    cl::desc("Name of the scalar argument of the top-level function that sets "
+             "the sample period of sampled tracer builds"),
+    cl::init("trace_sample_period"));
+
+static cl::opt<unsigned> maxChannels(
+    "controlflowtrace-max-channels",
+    cl::desc("Number of per-process cursors in the tracer for dataflow "
+             "processes, plus one (CONTROL_FLOW_TRACER_MAX_CHANNELS)"),
+    cl::init(8));
+
+static cl::opt<std::string> enableArgName(
+    "controlflowtrace-enable-arg",
+    cl::desc("Name of the scalar argument of the top-level function that "
+             "holds the per-region trace enable mask"),
+    cl::init("trace_enable"));
+
+static cl::opt<bool> threadTrace(
+    "controlflowtrace-thread-trace",
+    cl::desc("Add the trace array as the first argument of every function "
+             "that does not take it (as an argument of the same type and name "
+             "as the top-level function's), and pass it at every call"),
+    cl::init(true));
+
+static cl::opt<bool> explicitState(
+    "controlflowtrace-explicit-state",
+    cl::desc("Gather the statics of the tracer into a state struct that the pass "
+             "allocates for every function that no other function calls, and "
+             "threads through the functions it calls to every tracer function, "
+             "instead of relying on file-scope statics (no dataflow processes)"),
+    cl::init(false));
+
+static cl::opt<bool> traceCalls(
+    "controlflowtrace-calls",
+    cl::desc("Record a call record before and a return record after every "
+             "call to an instrumented function, so that the host can tell "
+             "the calling context of every record"),
+    cl::init(false));
+
+static cl::opt<bool> histogram(
+    "controlflowtrace-histogram",
+    cl::desc("Count the hits of every site in the tracer's on-chip counter "
+             "array, and copy the counts to the second half of the trace "
+             "array, which the records no longer use"),
+    cl::init(false));
+
+static cl::opt<bool> hierarchical(
+    "controlflowtrace-hierarchical",
+    cl::desc("Write basic block site records only in detail windows, to the "
+             "second half of the trace array, and all other records all the "
+             "time to the first half, along with records of function entries "
+             "and returns (blocks and loops mode only)"),
+    cl::init(false));
+
+static cl::opt<bool> signature(
+    "controlflowtrace-signature",
+    cl::desc("Fold every record into a CRC of the path each invocation takes, "
+             "and write only the CRC and the number of records folded into it "
+             "to the first two entries of the trace array"),
+    cl::init(false));
+
+static cl::opt<bool> packSites(
+    "controlflowtrace-pack-sites",
+    cl::desc("Pack several site records of the minimal width for the site table "
+             "into each word of the trace array (blocks mode only)"),
+    cl::init(false));
+
+// An instrumented record location. The index of a site in the site table is
+// the integer the tracer writes to the trace array when the site is reached.
+struct TraceSite {
+  std::string file;
+  std::string function;
+  unsigned line;
+  unsigned column;
+  std::string block;
+  // "block" for basic block records, "loop" for loop entry records, "pipeline"
+  // for the entry records of loops whose branches are recorded as bits, and
+  // "function" for the entry and return records of functions with
+  // -controlflowtrace-hierarchical.
+  std::string kind;
+};
+
+// A call to an instrumented function. The index of a call site in the "calls"
+// section of the site table is the payload of its call and return records.
+struct CallSite {
+  std::string file;
+  std::string function;
+  unsigned line;
+  unsigned column;
+  std::string callee;
+};
+
+// A function's control flow graph, exported so that the host can turn path
+// IDs (paths mode) or edge counters (edges mode) back into basic blocks.
+// Node -1 is the virtual ENTRY when it is the source of an edge, and the
+// virtual EXIT when it is the destination. Other nodes index blocks.
+struct GraphEdge {
+  int from;
+  int to;
+  // Ball-Larus edge value in paths mode.
+  uint64_t value;
+  // Index of the counter on this edge in edges mode. -1 if not counted.
+  int counter;
+};
+
+struct FunctionGraph {
+  std::string name;
+  // Path IDs of this function are [path_base, path_base + path_count).
+  uint64_t path_base;
+  uint64_t path_count;
+  std::vector<std::string> blocks;
+  std::vector<unsigned> lines;
+  std::vector<GraphEdge> edges;
+  // In branches mode, the site recorded on entry, and per block: the indices
+  // of its successors in order, the number of calls to instrumented functions,
+  // and whether a target record (instead of a bit) picks the successor.
+  int site;
+  std::vector<std::vector<int>> successors;
+  std::vector<int> calls;
+  std::vector<bool> targets;
+};
+
+// A pipelined loop whose branch outcomes are recorded as bits, exported so that
+// the host can replay its iterations. Block 0 is the header. Successors index
+// blocks, and -1 is any block outside of the loop.
+struct PipelinedLoop {
+  // The site recorded when the loop is entered.
+  int site;
+  std::vector<std::string> blocks;
+  std::vector<unsigned> lines;
+  std::vector<std::vector<int>> successors;
+};
+
+// Whether the function gets instrumented. Functions from the control flow
+// tracer, LLVM, and Vitis HLS are skipped, and so are declarations.
+static bool isInstrumented(const Function& func) {
+  auto fname = func.getName();
+  if (fname.contains("controlFlowTracer")
+      || fname.contains("llvm.dbg.declare")
+      || fname.contains("SpecArrayDimSizez")) {
+    return false;
+  }
+  return !func.isDeclaration();
+}
+
+// The trace argument of a function, cast to the type that a tracer function
+// takes. A trace stream or a wide trace array only gets its own tracer
+// functions from redirectRecords, and the calls made until then must be
+// well-typed.
+static Value* traceArg(Function& func, Function* tracer_func, IRBuilder<>& builder) {
+  return builder.CreatePointerCast(func.getArg(0),
+                                   tracer_func->getFunctionType()->getParamType(0));
+}
+
 template <typename T>
 void assert_(T val, const char *message) {
   if (!val) {
@@ -37,15 +299,83 @@ struct ControlFlowTracePass : public ModulePass {
   ControlFlowTracePass();
   virtual bool runOnModule(Module& module) override;
 
+  void getAnalysisUsage(AnalysisUsage& au) const override {
+    au.addRequired<LoopInfoWrapperPass>();
+  }
+
  private:
   Function* getTracerFunction(const TracerFunction tracerFunc);
   int getTracerFunctions(Module::FunctionListType& functions);
+  void selectTracerInstantiation(Function& top_func);
+
+  void threadTraceArray(Module& module, Function& top_func);
+  void instrumentTopFunction(Function& func);
+  void instrumentCalls(const std::vector<Function*>& funcs,
+                       const std::map<Function*, int>& processes);
+  void instrumentHistogram(const std::vector<Function*>& funcs, int array_size);
+  void instrumentHierarchy(const std::vector<Function*>& funcs, int array_size);
+  void instrumentFunctionBoundaries(Function& func);
+  bool isDetailRecord(const CallInst* call);
+  void packSiteRecords(const std::vector<Function*>& funcs);
+  void foldTracerConstants(Module& module, int array_size);
+  void allocateTracerState(Module& module);
+  int getTraceArraySize(Function& func);
+  void instrumentBlocks(Function& func, const std::set<BasicBlock*>& untraced_branches);
+  void instrumentLoops(Function& func, const std::vector<Loop*>& loops);
+  void instrumentPipelinedLoops(Function& func, const std::vector<Loop*>& loops);
+  bool isPipelinedLoop(const Loop* loop);
+  void instrumentPaths(Function& func);
+  void instrumentEdges(Function& func);
+  void instrumentBranches(Function& func);
+  void instrumentTimestamps(Function& func);
+  void instrumentRegions(const std::vector<Function*>& funcs);
+  Argument* getArgByName(Function& func, StringRef name);
+  std::map<Function*, int> findDataflowProcesses(const std::vector<Function*>& funcs);
+  void instrumentProcesses(const std::map<Function*, int>& channels, int array_size);
+  void instrumentStream(const std::vector<Function*>& funcs, Function& top_func);
+  void instrumentWide(const std::vector<Function*>& funcs, Function& top_func);
+  void instrumentSignature(const std::vector<Function*>& funcs, Function& top_func);
+  void redirectRecords(const std::vector<Function*>& funcs, Function* record_func,
+                       Function* stamp_func);
+  bool isWideTraceArray(Function& func);
+  int getRecordTag(const Function* callee);
+  Argument* getClockArg(Function& func);
+  Value* readClock(Argument* clock, IRBuilder<>& builder);
+  void exportBlocks(Function& func, FunctionGraph& graph);
+  Instruction* getEdgeInsertionPoint(BasicBlock* from, BasicBlock* to);
 
   std::pair<Instruction*, DILocation*> getInstructionLocationInfo(
       const BasicBlock* bb);
+  int addTraceSite(const BasicBlock* bb, const DILocation* loc,
+                   const char* kind = "block");
+  void writeSiteTable();
 
  private:
   std::map<std::string, Function*> tracerFunctions;
+  // The template arguments of the templated tracer's functions to use, e.g.
+  // "ILi260E", or empty if the plain tracer is linked.
+  std::string tracerInstantiation;
+  std::vector<TraceSite> traceSites;
+  std::vector<CallSite> callSites;
+  std::vector<FunctionGraph> functionGraphs;
+  std::vector<PipelinedLoop> pipelinedLoopGraphs;
+  // Number of edge counters allocated so far in edges mode.
+  unsigned numCounters = 0;
+  // Names of the functions in the order of their enable mask bits.
+  std::vector<std::string> regions;
+  // Names of the dataflow processes in the order of their channels, which
+  // start from one. Each channel owns a slice of channelSlice entries.
+  std::vector<std::string> processes;
+  int channelSlice = 0;
+  // Whether basic block site records go to detail windows in the second half
+  // of the trace data region. The other records then wrap in the first
+  // channelSlice entries.
+  bool detailSlice = false;
+  // Where the site histogram starts in the trace array, or 0 if there is none.
+  // The records then wrap in the first channelSlice entries.
+  int histogramOffset = 0;
+  // Bits per packed site record, or 0 if site records are not packed.
+  int siteBits = 0;
 };
 
 ControlFlowTracePass::ControlFlowTracePass() : ModulePass(ID) {}
@@ -59,123 +389,2213 @@ bool ControlFlowTracePass::runOnModule(Module& module) {
   assert_(top_func_name, "Environment variable HLS_TRACER_TOP_FUNCTION is not set.");
   errs() << "Using top-level function '" << top_func_name << "'.\n";
 
-  IRBuilder<> builder(module.getContext());
+  Function* top_func = nullptr;
+  std::vector<Function*> instrumented_funcs;
+
+  for (auto& func : module.getFunctionList()) {
+    if (isInstrumented(func) && func.getName().contains(top_func_name))
+      top_func = &func;
+  }
+  assert_(top_func, "Cannot find the top-level function!");
+  selectTracerInstantiation(*top_func);
+
+  // Every function is instrumented with its first argument as the trace
+  // array, so make sure that every function has it first.
+  if (threadTrace)
+    threadTraceArray(module, *top_func);
+  top_func = nullptr;
 
   // Insu: Use llvm::IRBuilder to create a call and insert it.
   for (auto& func : module.getFunctionList()) {
     auto fname = func.getName();
 
-    // Skip functions from the control flow tracer, LLVM, and Vitis HLS.
-    if (fname.contains("ControlFlowTracer")
-        || fname.contains("llvm.dbg.declare")
-        || fname.contains("SpecArrayDimSizez")) {
+    if (!isInstrumented(func))
       continue;
+
+    /**
+     * In loops mode, find the loops that can be recorded with trip counts.
+     * A loop needs a preheader to record its entry, and dedicated exit blocks
+     * to record its trip count without mixing in other control flow. The
+     * branches that leave such loops are not recorded individually, since
+     * the trip count already tells how many times they were taken.
+     */
+    std::vector<Loop*> traced_loops;
+    std::vector<Loop*> pipelined_loops;
+    std::set<BasicBlock*> untraced_branches;
+    if (traceMode == TraceMode::Blocks || traceMode == TraceMode::Loops) {
+      auto& loop_info = getAnalysis<LoopInfoWrapperPass>(func).getLoopInfo();
+      for (auto loop : loop_info.getLoopsInPreorder()) {
+        if (isPipelinedLoop(loop)) {
+          pipelined_loops.push_back(loop);
+          untraced_branches.insert(loop->block_begin(), loop->block_end());
+        }
+      }
+    }
+    if (traceMode == TraceMode::Loops) {
+      auto& loop_info = getAnalysis<LoopInfoWrapperPass>(func).getLoopInfo();
+      for (auto loop : loop_info.getLoopsInPreorder()) {
+        if (std::count(pipelined_loops.begin(), pipelined_loops.end(), loop))
+          continue;
+        if (!loop->getLoopPreheader() || !loop->hasDedicatedExits()) {
+          errs() << "Recording loop at " << loop->getHeader()->getName()
+                 << " per iteration since it is not in simplified form.\n";
+          continue;
+        }
+        traced_loops.push_back(loop);
+        SmallVector<BasicBlock*, 4> exiting_bbs;
+        loop->getExitingBlocks(exiting_bbs);
+        untraced_branches.insert(exiting_bbs.begin(), exiting_bbs.end());
+      }
     }
 
+    if (traceMode == TraceMode::Paths) {
+      instrumentPaths(func);
+    } else if (traceMode == TraceMode::Edges) {
+      instrumentEdges(func);
+    } else if (traceMode == TraceMode::Branches) {
+      instrumentBranches(func);
+    } else {
+      instrumentBlocks(func, untraced_branches);
+      instrumentLoops(func, traced_loops);
+      instrumentPipelinedLoops(func, pipelined_loops);
+    }
+    instrumentTimestamps(func);
+    instrumented_funcs.push_back(&func);
+
     // Found the top level function.
-    if (fname.contains(top_func_name)) {
-      /**
-       * Inject the init tracer function call at the beginning.
-       * To do so, we must first figure out the size of the input trace array.
-       * This information can be parsed from Vitis HLS's custom clang argument
-       * attribute 'fpga.decayed.dim.hint'.
-       */
-      int array_size = 0;
-      auto param_attr = func.getAttributes().getParamAttr(0, "fpga.decayed.dim.hint");
-      bool failed = param_attr.getValueAsString().getAsInteger(10, array_size);
-      assert_(!failed, "Failed to parse integer from 'fpga.decayed.dim.hint' attribute.");
-      errs() << "Trace array size is " << array_size << ".\n";
-
-      // Insert init function call.
-      auto initTracerFunc = getTracerFunction(TracerFunction::Init);
-      assert_(initTracerFunc, "Cannot find the init tracer function!");
-      auto fi = func.getBasicBlockList().begin()->getFirstInsertionPt();
-
-      ArrayRef<Value*> args = {builder.getInt32(array_size)};
-      builder.SetInsertPoint(&*fi);
-      builder.CreateCall(initTracerFunc, args);
-
-      errs() << "Inserted init function in the top-level function.\n";
-
-      /**
-       * Check whether there are return statements.
-       * Inject a finish tracer function call before each ret statement.
-       * This injction is for writing how many traces are inserted in DRAM.
-       */
-      for (auto& bb : func) {
-        for (auto& inst : bb) {
-          if (isa<ReturnInst>(&inst) == false)
-            continue;
-
-          auto finishTracerFunc = getTracerFunction(TracerFunction::Finish);
-          assert_(finishTracerFunc, "Cannot find the finish tracer function!");
-
-          ArrayRef<Value*> args = {func.getArg(0)};
-
-          builder.SetInsertPoint(&inst);
-          builder.CreateCall(finishTracerFunc, args);
-
-          errs() << "Inserted finish function.\n";
-        }
+    if (fname.contains(top_func_name))
+      top_func = &func;
+  }
+
+  // The top-level function is instrumented last, since in edges mode it
+  // needs the number of counters allocated in all functions.
+  assert_(top_func, "Cannot find the top-level function!");
+
+  // Dataflow processes and the functions they call write to their own
+  // channels. They are found once, since finding them also numbers the
+  // channels.
+  auto channels = findDataflowProcesses(instrumented_funcs);
+
+  // Call and return records go through the record calls like site records,
+  // so they are redirected along with them to streams, wide arrays, and
+  // channels.
+  if (traceCalls)
+    instrumentCalls(instrumented_funcs, channels);
+
+  // A path signature takes the place of the trace, so nothing else is written
+  // to the trace array.
+  if (signature) {
+    instrumentSignature(instrumented_funcs, *top_func);
+    if (explicitState)
+      allocateTracerState(module);
+    writeSiteTable();
+    return true;
+  }
+
+  // If the trace goes to a stream, all records are redirected to it, and
+  // there is no trace array to split or initialize.
+  auto trace_type = dyn_cast<PointerType>(top_func->getArg(0)->getType());
+  auto trace_elem = trace_type ? dyn_cast<StructType>(trace_type->getElementType()) : nullptr;
+  if (trace_elem && trace_elem->hasName() && trace_elem->getName().contains("hls::stream")) {
+    assert_(!hierarchical, "Streams do not support hierarchical tracing.");
+    instrumentStream(instrumented_funcs, *top_func);
+    if (explicitState)
+      allocateTracerState(module);
+    writeSiteTable();
+    return true;
+  }
+
+  // A trace array of words wider than a record is written a full word at a
+  // time by its own variant of the tracer.
+  if (isWideTraceArray(*top_func)) {
+    assert_(!hierarchical, "Wide trace arrays do not support hierarchical tracing.");
+    instrumentWide(instrumented_funcs, *top_func);
+    if (explicitState)
+      allocateTracerState(module);
+    writeSiteTable();
+    return true;
+  }
+
+  // The records wrap in the first 2^n entries of the trace array, and the last
+  // four hold the tail that the tracer writes at finish.
+  int data_size = getTraceArraySize(*top_func) - 4;
+  assert_(data_size > 0 && (data_size & (data_size - 1)) == 0,
+          "The trace array must have 2^n + 4 entries, or 2 with -controlflowtrace-signature.");
+
+  // Dataflow processes are left out of the regions, since entering a region
+  // would write tracer state shared with the other processes.
+  if (!channels.empty())
+    instrumentProcesses(channels, getTraceArraySize(*top_func));
+
+  if (getArgByName(*top_func, enableArgName)) {
+    std::vector<Function*> region_funcs;
+    for (auto func : instrumented_funcs) {
+      if (!channels.count(func))
+        region_funcs.push_back(func);
+    }
+    instrumentRegions(region_funcs);
+  }
+  if (histogram)
+    instrumentHistogram(instrumented_funcs, getTraceArraySize(*top_func));
+  if (hierarchical)
+    instrumentHierarchy(instrumented_funcs, getTraceArraySize(*top_func));
+  if (packSites)
+    packSiteRecords(instrumented_funcs);
+  instrumentTopFunction(*top_func);
+  foldTracerConstants(module, getTraceArraySize(*top_func));
+  if (explicitState)
+    allocateTracerState(module);
+
+  writeSiteTable();
+
+  return true;
+}
+
+// Move the parameter attributes of a function or call one parameter up, to make
+// room for a new first parameter.
+static AttributeList shiftParamAttributes(LLVMContext& context, AttributeList attrs,
+                                          unsigned num_params) {
+  std::vector<AttributeSet> params = {AttributeSet()};
+  for (unsigned i = 0; i < num_params; i++)
+    params.push_back(attrs.getParamAttributes(i));
+  return AttributeList::get(context, attrs.getFnAttributes(), attrs.getRetAttributes(), params);
+}
+
+// Move the body of a function to a new function with an extra first parameter
+// of the given type, which takes over the name, attributes, and metadata of the
+// old one. LLVM cannot add a parameter to a function in place. The old function
+// is left without a body, so that its calls can be rebuilt with
+// prependArgument before it is erased.
+static Function* prependParameter(Function* func, Type* type, StringRef name) {
+  std::vector<Type*> params = {type};
+  params.insert(params.end(), func->getFunctionType()->param_begin(),
+                func->getFunctionType()->param_end());
+  auto func_type = FunctionType::get(func->getReturnType(), params, func->isVarArg());
+  auto new_func = Function::Create(func_type, func->getLinkage(), "", func->getParent());
+  new_func->takeName(func);
+  new_func->copyAttributesFrom(func);
+  new_func->setAttributes(shiftParamAttributes(func->getContext(), func->getAttributes(),
+                                               func->arg_size()));
+
+  // A subprogram must only be attached to one function.
+  SmallVector<std::pair<unsigned, MDNode*>, 4> metadata;
+  func->getAllMetadata(metadata);
+  func->clearMetadata();
+  for (auto& entry : metadata)
+    new_func->setMetadata(entry.first, entry.second);
+
+  new_func->getBasicBlockList().splice(new_func->begin(), func->getBasicBlockList());
+  new_func->getArg(0)->setName(name);
+  for (unsigned i = 0; i < func->arg_size(); i++) {
+    func->getArg(i)->replaceAllUsesWith(new_func->getArg(i + 1));
+    new_func->getArg(i + 1)->takeName(func->getArg(i));
+  }
+  return new_func;
+}
+
+// Replace a call with a call to the given function made by prependParameter,
+// passing arg as the new first argument.
+static void prependArgument(CallInst* call, Function* new_func, Value* arg) {
+  std::vector<Value*> args = {arg};
+  for (unsigned i = 0; i < call->getNumArgOperands(); i++)
+    args.push_back(call->getArgOperand(i));
+  auto new_call = CallInst::Create(new_func, args, "", call);
+  new_call->takeName(call);
+  new_call->setCallingConv(call->getCallingConv());
+  new_call->setTailCallKind(call->getTailCallKind());
+  new_call->setAttributes(shiftParamAttributes(call->getContext(), call->getAttributes(),
+                                               call->getNumArgOperands()));
+  new_call->setDebugLoc(call->getDebugLoc());
+  call->replaceAllUsesWith(new_call);
+  call->eraseFromParent();
+}
+
+// The direct calls of a function. Asserts that it is not used otherwise, since
+// those uses could not be given a new argument.
+static std::vector<CallInst*> getDirectCalls(Function* func) {
+  std::vector<CallInst*> calls;
+  for (auto user : func->users()) {
+    auto call = dyn_cast<CallInst>(user);
+    assert_(call && call->getCalledFunction() == func,
+            "Cannot add an argument to a function that is not only called directly.");
+    calls.push_back(call);
+  }
+  return calls;
+}
+
+// Give every instrumented function besides the top-level function that does
+// not take the trace array as its first argument (one of the same type and name
+// as the first argument of the top-level function) a new first argument for it,
+// and pass the trace array of the caller at every call. This way the user does
+// not have to thread the trace array through every function by hand.
+void ControlFlowTracePass::threadTraceArray(Module& module, Function& top_func) {
+  assert_(top_func.arg_size() > 0, "The top-level function has no trace array argument.");
+  Argument* trace = top_func.getArg(0);
+  auto takesTrace = [trace](Function& func) {
+    return func.arg_size() > 0 && func.getArg(0)->getType() == trace->getType()
+        && func.getArg(0)->getName() == trace->getName();
+  };
+
+  std::vector<Function*> funcs;
+  for (auto& func : module.getFunctionList()) {
+    if (&func != &top_func && isInstrumented(func) && !takesTrace(func))
+      funcs.push_back(&func);
+  }
+
+  std::map<Function*, Function*> threaded;
+  for (auto func : funcs)
+    threaded[func] = prependParameter(func, trace->getType(), trace->getName());
+
+  // Every caller takes the trace array by now, either as the top-level
+  // function or as a threaded one.
+  for (auto& entry : threaded) {
+    for (auto call : getDirectCalls(entry.first))
+      prependArgument(call, entry.second, call->getFunction()->getArg(0));
+    entry.first->eraseFromParent();
+    errs() << "Threaded the trace array through " << entry.second->getName() << ".\n";
+  }
+}
+
+// Figure out the size of the trace array of the top-level function. This
+// information can be parsed from Vitis HLS's custom clang argument attribute
+// 'fpga.decayed.dim.hint'.
+int ControlFlowTracePass::getTraceArraySize(Function& func) {
+  int array_size = 0;
+  auto param_attr = func.getAttributes().getParamAttr(0, "fpga.decayed.dim.hint");
+  bool failed = param_attr.getValueAsString().getAsInteger(10, array_size);
+  assert_(!failed, "Failed to parse integer from 'fpga.decayed.dim.hint' attribute.");
+  return array_size;
+}
+
+// Surround every call to an instrumented function with a call record and a
+// return record of its call site, so that the host can keep a call stack and
+// tell which caller reached each record. Calls to dataflow processes are left
+// alone, since the process calls must stay the only statements of their
+// dataflow region. The return record goes after the enter call that
+// instrumentRegions puts after the call, so that it is recorded whenever the
+// call record was.
+void ControlFlowTracePass::instrumentCalls(const std::vector<Function*>& funcs,
+                                           const std::map<Function*, int>& processes) {
+  assert_(traceMode != TraceMode::Edges, "Edges mode writes no records to add calls to.");
+  assert_(traceMode != TraceMode::Branches,
+          "Branches mode already replays calls from the function entry records.");
+  auto recordCallTracerFunc = getTracerFunction(TracerFunction::RecordCall);
+  assert_(recordCallTracerFunc, "Cannot find the call record tracer function!");
+  auto recordReturnTracerFunc = getTracerFunction(TracerFunction::RecordReturn);
+  assert_(recordReturnTracerFunc, "Cannot find the return record tracer function!");
+
+  IRBuilder<> builder(recordCallTracerFunc->getContext());
+  for (auto func : funcs) {
+    std::vector<CallInst*> calls;
+    for (auto& bb : *func) {
+      for (auto& inst : bb) {
+        auto call = dyn_cast<CallInst>(&inst);
+        if (!call)
+          continue;
+        auto callee = call->getCalledFunction();
+        if (callee && isInstrumented(*callee) && !processes.count(callee))
+          calls.push_back(call);
+      }
+    }
+
+    auto subprogram = func->getSubprogram();
+    for (auto call : calls) {
+      CallSite call_site;
+      call_site.function = (subprogram ? subprogram->getName() : func->getName()).str();
+      call_site.line = 0;
+      call_site.column = 0;
+      if (auto loc = call->getDebugLoc().get()) {
+        call_site.file = loc->getFilename().str();
+        call_site.line = loc->getLine();
+        call_site.column = loc->getColumn();
+      }
+      auto callee_subprogram = call->getCalledFunction()->getSubprogram();
+      call_site.callee = (callee_subprogram ? callee_subprogram->getName()
+                                            : call->getCalledFunction()->getName()).str();
+      callSites.push_back(call_site);
+      auto id = builder.getInt32(callSites.size() - 1);
+
+      builder.SetInsertPoint(call);
+      builder.CreateCall(recordCallTracerFunc,
+                         {traceArg(*func, recordCallTracerFunc, builder), id});
+      builder.SetInsertPoint(call->getNextNode());
+      builder.CreateCall(recordReturnTracerFunc,
+                         {traceArg(*func, recordReturnTracerFunc, builder), id});
+    }
+  }
+  errs() << "Inserted call and return records at " << callSites.size() << " call site(s).\n";
+}
+
+// Count the hits of every site on chip, so that the host gets exact counts even
+// when the trace wrapped. The count call goes right before every record call,
+// so it is not subject to sampling, triggering, or packing, but only counts in
+// enabled regions. The counters are the ones edges mode uses, indexed by site.
+// They are copied to the second half of the trace data region at finish, and
+// the records wrap in the first half.
+void ControlFlowTracePass::instrumentHistogram(const std::vector<Function*>& funcs,
+                                               int array_size) {
+  assert_(traceMode != TraceMode::Edges, "Edges mode already uses the counter array.");
+  assert_(processes.empty(), "Dataflow processes do not support the site histogram.");
+  assert_(traceSites.size() <= maxCounters,
+          "Too many sites for the histogram. Increase CONTROL_FLOW_TRACER_MAX_COUNTERS "
+          "and -controlflowtrace-max-counters.");
+  channelSlice = (array_size - 4) / 2;
+  histogramOffset = channelSlice;
+  assert_(traceSites.size() <= (unsigned)channelSlice,
+          "The trace array is too small to hold the site histogram in its second half.");
+
+  auto recordTracerFunc = getTracerFunction(TracerFunction::Record);
+  auto countTracerFunc = getTracerFunction(TracerFunction::Count);
+  assert_(countTracerFunc, "Cannot find the count tracer function! Build the tracer with "
+                           "CONTROL_FLOW_TRACER_COUNTERS.");
+
+  IRBuilder<> builder(countTracerFunc->getContext());
+  for (auto func : funcs) {
+    for (auto& bb : *func) {
+      for (auto& inst : bb) {
+        auto call = dyn_cast<CallInst>(&inst);
+        if (!call || !call->getCalledFunction() || call->getCalledFunction() != recordTracerFunc)
+          continue;
+        builder.SetInsertPoint(call);
+        builder.CreateCall(countTracerFunc, {call->getArgOperand(1)});
+      }
+    }
+  }
+  errs() << "Counting " << traceSites.size() << " sites at entry " << histogramOffset
+         << " of the trace array.\n";
+}
+
+// Split the records into two levels. Basic block site records are the detail
+// level, and are only written to the second half of the trace data region
+// while a detail window is open. All other records, e.g. loop entries, trip
+// counts, calls, and returns, are the coarse level, and are always written to
+// the first half, in which they wrap as if it were slice 0 of two. Every
+// function also gets coarse records at its entry and returns. Coarse site
+// records count toward opening the next window.
+void ControlFlowTracePass::instrumentHierarchy(const std::vector<Function*>& funcs,
+                                               int array_size) {
+  assert_(traceMode == TraceMode::Blocks || traceMode == TraceMode::Loops,
+          "Only blocks and loops mode write basic block site records to leave to "
+          "the detail level.");
+  assert_(processes.empty(), "Dataflow processes do not support hierarchical tracing.");
+  assert_(!histogramOffset, "The site histogram and the detail level cannot share "
+                            "the second half of the trace array.");
+  assert_(!packSites, "Detail records cannot be packed.");
+  channelSlice = (array_size - 4) / 2;
+  detailSlice = true;
+
+  auto recordTracerFunc = getTracerFunction(TracerFunction::Record);
+  auto openWindowTracerFunc = getTracerFunction(TracerFunction::OpenWindow);
+  assert_(openWindowTracerFunc, "Cannot find the open window tracer function! Build the "
+                                "tracer with CONTROL_FLOW_TRACER_HIERARCHICAL.");
+  auto recordDetailTracerFunc = getTracerFunction(TracerFunction::RecordDetail);
+  assert_(recordDetailTracerFunc, "Cannot find the detail record tracer function!");
+
+  IRBuilder<> builder(recordDetailTracerFunc->getContext());
+  int details = 0;
+  for (auto func : funcs) {
+    instrumentFunctionBoundaries(*func);
+
+    std::vector<CallInst*> calls;
+    for (auto& bb : *func) {
+      for (auto& inst : bb) {
+        auto call = dyn_cast<CallInst>(&inst);
+        if (call && call->getCalledFunction() && call->getCalledFunction() == recordTracerFunc)
+          calls.push_back(call);
+      }
+    }
+
+    for (auto call : calls) {
+      builder.SetInsertPoint(call);
+      if (isDetailRecord(call)) {
+        builder.CreateCall(recordDetailTracerFunc,
+                           {call->getArgOperand(0), call->getArgOperand(1)});
+        call->eraseFromParent();
+        details++;
+      } else {
+        builder.CreateCall(openWindowTracerFunc,
+                           {call->getArgOperand(0), call->getArgOperand(1)});
       }
     }
+  }
+  errs() << "Writing " << details << " basic block site records to detail windows at entry "
+         << channelSlice << " of the trace array.\n";
+}
+
+// Record the entry and every return of a function as coarse sites of kind
+// "function", so that windows open even in functions that have no other coarse
+// records, e.g. in blocks mode without pipelined loops. They are stamped like
+// the other coarse records.
+void ControlFlowTracePass::instrumentFunctionBoundaries(Function& func) {
+  auto recordTracerFunc = getTracerFunction(TracerFunction::Record);
+  auto stampTracerFunc = getTracerFunction(TracerFunction::Stamp);
+  auto clock = getClockArg(func);
+
+  IRBuilder<> builder(func.getContext());
+  auto entry = getInstructionLocationInfo(&func.getEntryBlock());
+  std::vector<std::pair<Instruction*, DILocation*>> boundaries = {entry};
+  for (auto& bb : func) {
+    auto ret = dyn_cast<ReturnInst>(bb.getTerminator());
+    if (!ret)
+      continue;
+    auto loc = ret->getDebugLoc().get();
+    boundaries.push_back({ret, loc ? loc : entry.second});
+  }
+
+  for (auto& boundary : boundaries) {
+    int site = addTraceSite(boundary.first->getParent(), boundary.second, "function");
+    builder.SetInsertPoint(boundary.first);
+    if (clock)
+      builder.CreateCall(stampTracerFunc,
+                         {traceArg(func, stampTracerFunc, builder), readClock(clock, builder)});
+    builder.CreateCall(recordTracerFunc,
+                       {traceArg(func, recordTracerFunc, builder), builder.getInt32(site)});
+  }
+  errs() << "Inserted " << boundaries.size() << " function boundary record(s) in "
+         << func.getName() << "\n";
+}
+
+// Whether the call writes the site record of a basic block, which only goes to
+// the detail level with -controlflowtrace-hierarchical.
+bool ControlFlowTracePass::isDetailRecord(const CallInst* call) {
+  if (!hierarchical || call->getCalledFunction() != getTracerFunction(TracerFunction::Record))
+    return false;
+  auto site = dyn_cast<ConstantInt>(call->getArgOperand(1));
+  return site && site->getZExtValue() < traceSites.size()
+         && traceSites[site->getZExtValue()].kind == "block";
+}
+
+// Pack several site records into each word of the trace array. With N sites,
+// a site ID fits in the smallest W bits with 2^W - 1 >= N, which leaves the
+// all-ones ID to pad the last word. Every record call is replaced with a call
+// to the packed record function, which is inlined, so that W is a constant in
+// the hardware. Only site records can be packed, so this needs blocks mode
+// without cycle stamps or pipelined loops.
+void ControlFlowTracePass::packSiteRecords(const std::vector<Function*>& funcs) {
+  assert_(traceMode == TraceMode::Blocks,
+          "Only blocks mode writes nothing but site records, which can be packed.");
+  assert_(processes.empty(), "Dataflow processes do not support packed site records.");
+  assert_(pipelinedLoopGraphs.empty(),
+          "Branch bits cannot be packed with site records. Pass "
+          "-controlflowtrace-pipelined-loops=none.");
+  assert_(callSites.empty(), "Call records cannot be packed with site records.");
+
+  siteBits = 1;
+  while ((1u << siteBits) - 1 < traceSites.size())
+    siteBits++;
+  assert_(siteBits <= 16, "Too many sites to pack more than one record into a word.");
+
+  auto recordTracerFunc = getTracerFunction(TracerFunction::Record);
+  auto stampTracerFunc = getTracerFunction(TracerFunction::Stamp);
+  auto recordPackedTracerFunc = getTracerFunction(TracerFunction::RecordPacked);
+  assert_(recordPackedTracerFunc, "Cannot find the packed record tracer function! Build "
+                                  "the tracer with CONTROL_FLOW_TRACER_PACKED.");
+
+  IRBuilder<> builder(recordPackedTracerFunc->getContext());
+  for (auto func : funcs) {
+    std::vector<CallInst*> calls;
+    for (auto& bb : *func) {
+      for (auto& inst : bb) {
+        auto call = dyn_cast<CallInst>(&inst);
+        if (!call)
+          continue;
+        auto callee = call->getCalledFunction();
+        assert_(!callee || callee != stampTracerFunc,
+                "Cycle stamps cannot be packed with site records.");
+        if (callee && callee == recordTracerFunc)
+          calls.push_back(call);
+      }
+    }
+
+    for (auto call : calls) {
+      builder.SetInsertPoint(call);
+      builder.CreateCall(recordPackedTracerFunc, {call->getArgOperand(0), call->getArgOperand(1),
+                                                  builder.getInt32(siteBits)});
+      call->eraseFromParent();
+    }
+  }
+  errs() << "Packing " << 32 / siteBits << " site records of " << siteBits
+         << " bits into each word.\n";
+}
+
+// The size of the trace array is known at compile time, so fold the statics of
+// the tracer that only hold values derived from it into constants, and let
+// Vitis HLS drop the registers and logic behind them. The statics are only
+// found when the tracer is linked into the module, as hls_tracer.tcl does.
+void ControlFlowTracePass::foldTracerConstants(Module& module, int array_size) {
+  // With dataflow processes or a histogram, the records outside of processes
+  // wrap in a slice.
+  int data_size = channelSlice ? channelSlice : array_size - 4;
+  std::map<std::string, int> constants = {
+      {"buffer_size_", array_size},
+      {"buffer_size_mask_", data_size - 1},
+      {"buffer_wrapped_mask_", data_size},
+  };
+  for (auto& entry : constants) {
+    auto global = module.getGlobalVariable(entry.first, true);
+    if (!global || !global->hasLocalLinkage())
+      continue;
+    bool foldable = true;
+    for (auto user : global->users()) {
+      if (!isa<LoadInst>(user) && !isa<StoreInst>(user))
+        foldable = false;
+    }
+    if (!foldable)
+      continue;
+
+    // The tracer only ever stores these same values, so the stores can go.
+    std::vector<Instruction*> users;
+    for (auto user : global->users())
+      users.push_back(cast<Instruction>(user));
+    for (auto inst : users) {
+      if (isa<LoadInst>(inst))
+        inst->replaceAllUsesWith(ConstantInt::get(inst->getType(), entry.second));
+      inst->eraseFromParent();
+    }
+    global->eraseFromParent();
+    errs() << "Folded " << entry.first << " into " << entry.second << ".\n";
+  }
+}
+
+// Turn the uses of a constant expression in a function into instructions, so
+// that the constants in it can be replaced with values of the function. Outer
+// expressions go first, so that their instructions use this expression.
+static void expandConstantExpr(ConstantExpr* expr, Function* func) {
+  std::vector<ConstantExpr*> outer_exprs;
+  for (auto user : expr->users()) {
+    if (auto outer = dyn_cast<ConstantExpr>(user))
+      outer_exprs.push_back(outer);
+  }
+  for (auto outer : outer_exprs)
+    expandConstantExpr(outer, func);
+
+  std::vector<Use*> uses;
+  for (auto& use : expr->uses())
+    uses.push_back(&use);
+  for (auto use : uses) {
+    auto inst = dyn_cast<Instruction>(use->getUser());
+    if (!inst || inst->getFunction() != func)
+      continue;
+    Instruction* insert_point = inst;
+    if (auto phi = dyn_cast<PHINode>(inst))
+      insert_point = phi->getIncomingBlock(*use)->getTerminator();
+    auto expr_inst = expr->getAsInstruction();
+    expr_inst->insertBefore(insert_point);
+    use->set(expr_inst);
+  }
+}
+
+// Gather the statics of the tracer (the internal globals that only tracer
+// functions use) into a state struct, and give every tracer function a pointer
+// to it as a new first parameter, through which it accesses them. The pass
+// allocates one state for every function that reaches a tracer call and is not
+// called by another function (the top-level function, and any other kernel in
+// the module), named after it. The functions they call get the state of their
+// caller as a new first parameter, like threadTraceArray does for the trace
+// array, so that every kernel writes its own state. This needs the tracer
+// linked into the module, as hls_tracer.tcl does, and runs after
+// foldTracerConstants, so that the folded statics are gone.
+void ControlFlowTracePass::allocateTracerState(Module& module) {
+  // The channel cursors are partitioned into a register per process by pragmas
+  // on the statics, which would not carry over to fields of the struct.
+  assert_(processes.empty(),
+          "Dataflow processes do not support -controlflowtrace-explicit-state.");
+
+  std::set<Function*> tracer_funcs;
+  for (auto& func : module.getFunctionList()) {
+    if (func.getName().contains("controlFlowTracer") && !func.isDeclaration())
+      tracer_funcs.insert(&func);
+  }
+  assert_(!tracer_funcs.empty(),
+          "The tracer must be linked into the module to gather its statics into a state.");
+
+  // Whether all uses of a value, also through constant expressions, are in
+  // tracer functions.
+  std::function<bool(Value*)> onlyInTracer = [&](Value* value) {
+    for (auto user : value->users()) {
+      if (auto inst = dyn_cast<Instruction>(user)) {
+        if (!tracer_funcs.count(inst->getFunction()))
+          return false;
+      } else if (!isa<ConstantExpr>(user) || !onlyInTracer(user)) {
+        return false;
+      }
+    }
+    return true;
+  };
+  std::vector<GlobalVariable*> statics;
+  std::vector<Type*> fields;
+  std::vector<Constant*> initializers;
+  for (auto& global : module.globals()) {
+    global.removeDeadConstantUsers();
+    if (!global.hasLocalLinkage() || global.isConstant() || !global.hasInitializer()
+        || global.use_empty() || !onlyInTracer(&global))
+      continue;
+    statics.push_back(&global);
+    fields.push_back(global.getValueType());
+    initializers.push_back(global.getInitializer());
+  }
+
+  // The user functions that reach a tracer call, directly or through the
+  // functions they call.
+  std::set<Function*> users;
+  std::vector<Function*> worklist(tracer_funcs.begin(), tracer_funcs.end());
+  while (!worklist.empty()) {
+    auto callee = worklist.back();
+    worklist.pop_back();
+    for (auto call : getDirectCalls(callee)) {
+      Function* caller = call->getFunction();
+      if (!tracer_funcs.count(caller) && users.insert(caller).second)
+        worklist.push_back(caller);
+    }
+  }
+
+  auto state_type = StructType::create(module.getContext(), fields, "struct.controlFlowTracerState");
+  auto state_ptr_type = PointerType::getUnqual(state_type);
+
+  // Every function with a state parameter uses it, and the functions that no
+  // other function calls use their own state.
+  std::map<Function*, Value*> states;
+  std::map<Function*, Function*> stateful;
+  for (auto func : tracer_funcs)
+    stateful[func] = prependParameter(func, state_ptr_type, "state");
+  for (auto func : users) {
+    if (func->use_empty()) {
+      states[func] = new GlobalVariable(module, state_type, false, GlobalValue::InternalLinkage,
+                                        ConstantStruct::get(state_type, initializers),
+                                        "controlFlowTracerState." + func->getName().str());
+      errs() << "Allocated " << states[func]->getName() << ".\n";
+    } else {
+      stateful[func] = prependParameter(func, state_ptr_type, "state");
+      errs() << "Threaded the tracer state through " << stateful[func]->getName() << ".\n";
+    }
+  }
+  for (auto& entry : stateful)
+    states[entry.second] = entry.second->getArg(0);
+
+  // Replace the statics with pointers to their fields.
+  for (auto& entry : stateful) {
+    Function* func = entry.second;
+    if (!tracer_funcs.count(entry.first))
+      continue;
+    IRBuilder<> builder(&*func->getEntryBlock().getFirstInsertionPt());
+    for (size_t i = 0; i < statics.size(); i++) {
+      std::vector<ConstantExpr*> exprs;
+      for (auto user : statics[i]->users()) {
+        if (auto expr = dyn_cast<ConstantExpr>(user))
+          exprs.push_back(expr);
+      }
+      for (auto expr : exprs)
+        expandConstantExpr(expr, func);
+
+      std::vector<Use*> uses;
+      for (auto& use : statics[i]->uses()) {
+        auto inst = dyn_cast<Instruction>(use.getUser());
+        if (inst && inst->getFunction() == func)
+          uses.push_back(&use);
+      }
+      if (uses.empty())
+        continue;
+      auto field = builder.CreateStructGEP(state_type, func->getArg(0), i, statics[i]->getName());
+      for (auto use : uses)
+        use->set(field);
+    }
+  }
 
+  // Every caller passes its own state on.
+  for (auto& entry : stateful) {
+    for (auto call : getDirectCalls(entry.first))
+      prependArgument(call, entry.second, states.at(call->getFunction()));
+    entry.first->eraseFromParent();
+  }
+  for (auto global : statics) {
+    global->removeDeadConstantUsers();
+    global->eraseFromParent();
+  }
+  errs() << "Gathered " << statics.size() << " tracer statics into a state.\n";
+}
+
+// Inject the init and finish tracer function calls into the top-level
+// function. This runs after the function body has been instrumented, so that
+// the init call comes before and the finish calls come after every record.
+void ControlFlowTracePass::instrumentTopFunction(Function& func) {
+  IRBuilder<> builder(func.getContext());
+
+  // Inject the init tracer function call at the beginning.
+  int array_size = getTraceArraySize(func);
+  errs() << "Trace array size is " << array_size << ".\n";
+
+  // Insert init function call.
+  auto initTracerFunc = getTracerFunction(TracerFunction::Init);
+  assert_(initTracerFunc, "Cannot find the init tracer function!");
+  auto fi = func.getBasicBlockList().begin()->getFirstInsertionPt();
+
+  ArrayRef<Value*> args = {builder.getInt32(array_size)};
+  builder.SetInsertPoint(&*fi);
+  builder.CreateCall(initTracerFunc, args);
+
+  errs() << "Inserted init function in the top-level function.\n";
+
+  // Split the trace array into one slice per channel, or leave the second half
+  // to the histogram or the detail level.
+  if (channelSlice) {
+    auto initChannelsTracerFunc = getTracerFunction(TracerFunction::InitChannels);
+    assert_(initChannelsTracerFunc, "Cannot find the init channels tracer function!");
+    builder.CreateCall(initChannelsTracerFunc,
+                       {func.getArg(0), builder.getInt32(processes.size()),
+                        builder.getInt32(channelSlice)});
+  }
+
+  // In edges mode, the counters are cleared right after init and copied to
+  // the trace array right before finish.
+  Function* flushCountersTracerFunc = nullptr;
+  if (traceMode == TraceMode::Edges) {
+    assert_(numCounters <= maxCounters,
+            "Too many edge counters. Increase CONTROL_FLOW_TRACER_MAX_COUNTERS "
+            "and -controlflowtrace-max-counters.");
+    assert_(numCounters <= (unsigned)array_size - 4,
+            "The trace array is too small to hold all edge counters.");
+    auto clearCountersTracerFunc = getTracerFunction(TracerFunction::ClearCounters);
+    assert_(clearCountersTracerFunc, "Cannot find the clear counters tracer function!");
+    flushCountersTracerFunc = getTracerFunction(TracerFunction::FlushCounters);
+    assert_(flushCountersTracerFunc, "Cannot find the flush counters tracer function!");
+    builder.CreateCall(clearCountersTracerFunc, {builder.getInt32(numCounters)});
+    errs() << "Using " << numCounters << " edge counters.\n";
+  }
+  Function* flushHistogramTracerFunc = nullptr;
+  if (histogramOffset) {
+    auto clearCountersTracerFunc = getTracerFunction(TracerFunction::ClearCounters);
+    assert_(clearCountersTracerFunc, "Cannot find the clear counters tracer function!");
+    flushHistogramTracerFunc = getTracerFunction(TracerFunction::FlushHistogram);
+    assert_(flushHistogramTracerFunc, "Cannot find the flush histogram tracer function!");
+    builder.CreateCall(clearCountersTracerFunc, {builder.getInt32(traceSites.size())});
+  }
+  Function* finishDetailTracerFunc = nullptr;
+  if (detailSlice) {
+    auto initDetailTracerFunc = getTracerFunction(TracerFunction::InitDetail);
+    assert_(initDetailTracerFunc, "Cannot find the init detail tracer function!");
+    finishDetailTracerFunc = getTracerFunction(TracerFunction::FinishDetail);
+    assert_(finishDetailTracerFunc, "Cannot find the finish detail tracer function!");
+    builder.CreateCall(initDetailTracerFunc, {func.getArg(0)});
+  }
+
+  // Pass the sample period argument on to the tracer.
+  if (auto period = getArgByName(func, samplePeriodArgName)) {
+    assert_(period->getType()->isIntegerTy(), "The sample period argument must be an integer.");
+    auto setSamplePeriodTracerFunc = getTracerFunction(TracerFunction::SetSamplePeriod);
+    assert_(setSamplePeriodTracerFunc, "Cannot find the set sample period tracer function!");
+    builder.CreateCall(setSamplePeriodTracerFunc,
+                       {builder.CreateSExtOrTrunc(period, builder.getInt32Ty())});
+    errs() << "Using argument '" << period->getName() << "' as the sample period.\n";
+  }
+
+  // Pass the enable mask argument on to the tracer. This comes before the
+  // enter call that instrumentRegions put at the top of the function.
+  if (auto enable = getArgByName(func, enableArgName)) {
+    assert_(enable->getType()->isIntegerTy(), "The enable argument must be an integer.");
+    auto enableTracerFunc = getTracerFunction(TracerFunction::Enable);
+    assert_(enableTracerFunc, "Cannot find the enable tracer function!");
+    builder.CreateCall(enableTracerFunc,
+                       {builder.CreateSExtOrTrunc(enable, builder.getInt32Ty())});
+    errs() << "Using argument '" << enable->getName() << "' as the enable mask.\n";
+  }
+
+  // Latch the clock so that the first stamp counts from the start. Edges mode
+  // writes no records to stamp.
+  auto clock = traceMode == TraceMode::Edges ? nullptr : getClockArg(func);
+  if (clock) {
+    auto startClockTracerFunc = getTracerFunction(TracerFunction::StartClock);
+    assert_(startClockTracerFunc, "Cannot find the start clock tracer function!");
+    builder.CreateCall(startClockTracerFunc, {readClock(clock, builder)});
+  }
+
+  /**
+   * Check whether there are return statements.
+   * Inject a finish tracer function call before each ret statement.
+   * This injction is for writing how many traces are inserted in DRAM.
+   */
+  for (auto& bb : func) {
+    for (auto& inst : bb) {
+      if (isa<ReturnInst>(&inst) == false)
+        continue;
+
+      auto finishTracerFunc = getTracerFunction(TracerFunction::Finish);
+      assert_(finishTracerFunc, "Cannot find the finish tracer function!");
+
+      ArrayRef<Value*> args = {func.getArg(0)};
+
+      builder.SetInsertPoint(&inst);
+      if (clock) {
+        // Stamp the end so that the last record gets its cycles too.
+        auto stampTracerFunc = getTracerFunction(TracerFunction::Stamp);
+        assert_(stampTracerFunc, "Cannot find the stamp tracer function!");
+        builder.CreateCall(stampTracerFunc, {func.getArg(0), readClock(clock, builder)});
+      }
+      if (flushCountersTracerFunc) {
+        builder.CreateCall(flushCountersTracerFunc,
+                           {func.getArg(0), builder.getInt32(numCounters)});
+      }
+      if (flushHistogramTracerFunc) {
+        builder.CreateCall(flushHistogramTracerFunc,
+                           {func.getArg(0), builder.getInt32(histogramOffset),
+                            builder.getInt32(traceSites.size())});
+      }
+      if (finishDetailTracerFunc)
+        builder.CreateCall(finishDetailTracerFunc, {func.getArg(0)});
+      builder.CreateCall(finishTracerFunc, args);
+
+      errs() << "Inserted finish function.\n";
+    }
+  }
+}
+
+// Insert record function calls at the successors of conditional branches,
+// except for the branches in untraced_branches.
+void ControlFlowTracePass::instrumentBlocks(
+    Function& func, const std::set<BasicBlock*>& untraced_branches) {
+  IRBuilder<> builder(func.getContext());
+
+  /**
+   * Inject record functions.
+   *
+   * Algorithm: Figure out candidate BBs where we would like to insert calls.
+   * First, store all successor BBs of BBs that end with a conditional branch.
+   * Recording control flow at all these branches are sufficient to record the
+   * control flow.
+   * Next, we remove BBs that end with a conditional branch themselves. These BBs
+   * are essentially redundant because every control flow that reaches these BBs
+   * are tracked by their successor BBs.
+   */
+  std::vector<BasicBlock*> record_candidate_bbs;
+
+  // Whether the conditional branch at the end of the BB is to be recorded.
+  auto isRecordedBranch = [&untraced_branches](BasicBlock* bb) {
     /**
-     * Inject record functions.
-     *
-     * Algorithm: Figure out candidate BBs where we would like to insert calls.
-     * First, store all successor BBs of BBs that end with a conditional branch.
-     * Recording control flow at all these branches are sufficient to record the
-     * control flow.
-     * Next, we remove BBs that end with a conditional branch themselves. These BBs
-     * are essentially redundant because every control flow that reaches these BBs
-     * are tracked by their successor BBs.
+     * https://llvm.org/docs/LangRef.html#terminator-instructions
+     * Every block ends with a terminator instruction (== last instruction).
      */
-    std::vector<BasicBlock*> record_candidate_bbs;
-
-    // First state: add all successor BBs of BBs with cmp+br.
-    for (auto& bb : func) {
-      /**
-       * https://llvm.org/docs/LangRef.html#terminator-instructions
-       * Every block ends with a terminator instruction (== last instruction).
-       */
-      auto termi = dyn_cast<BranchInst>(bb.getTerminator());
-      if (termi && termi->isConditional()) {
-        for (auto succ : successors(&bb)) {
-          record_candidate_bbs.push_back(succ);
+    auto termi = dyn_cast<BranchInst>(bb->getTerminator());
+    return termi && termi->isConditional() && !untraced_branches.count(bb);
+  };
+
+  // First state: add all successor BBs of BBs with cmp+br.
+  for (auto& bb : func) {
+    if (isRecordedBranch(&bb)) {
+      for (auto succ : successors(&bb)) {
+        record_candidate_bbs.push_back(succ);
+      }
+    }
+  }
+
+  // Second stage: remove BBs if it ends with a conditional branch.
+  auto remove = std::remove_if(
+      record_candidate_bbs.begin(), record_candidate_bbs.end(),
+      isRecordedBranch);
+  record_candidate_bbs.erase(remove, record_candidate_bbs.end());
+
+  // Insert tracer function call at the first location of each target BB.
+  auto recordTracerFunc = getTracerFunction(TracerFunction::Record);
+  assert_(recordTracerFunc, "Cannot find the record tracer function!");
+  for (auto bb : record_candidate_bbs) {
+    auto inst = getInstructionLocationInfo(bb);
+    int site = addTraceSite(bb, inst.second);
+
+    builder.SetInsertPoint(inst.first);
+    builder.CreateCall(recordTracerFunc,
+                       {traceArg(func, recordTracerFunc, builder), builder.getInt32(site)});
+
+    errs() << "Inserted record function for site " << site << " at "
+           << inst.second->getFilename() << ":" << inst.second->getLine()
+           << ":" << inst.second->getColumn() << "\n";
+  }
+}
+
+// Record loop entries and trip counts instead of every iteration.
+// Each loop gets a counter in a local variable. The preheader clears the
+// counter and writes a site record for the loop, the header increments the
+// counter, and every exit block writes the counter as a trip count record.
+// The trip count is thus the number of times the header executed, which is
+// also how LLVM defines it.
+void ControlFlowTracePass::instrumentLoops(Function& func,
+                                           const std::vector<Loop*>& loops) {
+  if (loops.empty())
+    return;
+
+  auto recordTracerFunc = getTracerFunction(TracerFunction::Record);
+  assert_(recordTracerFunc, "Cannot find the record tracer function!");
+  auto recordTripTracerFunc = getTracerFunction(TracerFunction::RecordTrip);
+  assert_(recordTripTracerFunc, "Cannot find the trip count record tracer function!");
+
+  IRBuilder<> builder(func.getContext());
+  for (auto loop : loops) {
+    auto header = loop->getHeader();
+    auto loc = getInstructionLocationInfo(header).second;
+    int site = addTraceSite(header, loc, "loop");
+
+    builder.SetInsertPoint(&*func.getEntryBlock().getFirstInsertionPt());
+    auto trips = builder.CreateAlloca(builder.getInt32Ty(), nullptr, "trace.trips");
+
+    builder.SetInsertPoint(loop->getLoopPreheader()->getTerminator());
+    builder.CreateStore(builder.getInt32(0), trips);
+    builder.CreateCall(recordTracerFunc,
+                       {traceArg(func, recordTracerFunc, builder), builder.getInt32(site)});
+
+    builder.SetInsertPoint(&*header->getFirstInsertionPt());
+    auto count = builder.CreateLoad(builder.getInt32Ty(), trips);
+    builder.CreateStore(builder.CreateAdd(count, builder.getInt32(1)), trips);
+
+    SmallVector<BasicBlock*, 4> exit_bbs;
+    loop->getUniqueExitBlocks(exit_bbs);
+    for (auto exit_bb : exit_bbs) {
+      builder.SetInsertPoint(&*exit_bb->getFirstInsertionPt());
+      count = builder.CreateLoad(builder.getInt32Ty(), trips);
+      builder.CreateCall(recordTripTracerFunc,
+                         {traceArg(func, recordTripTracerFunc, builder), count});
+    }
+
+    errs() << "Inserted loop records for site " << site << " at "
+           << loc->getFilename() << ":" << loc->getLine() << ":"
+           << loc->getColumn() << " with " << exit_bbs.size()
+           << " exit(s)\n";
+  }
+}
+
+// Whether the branches of the loop are to be recorded as bits. Only innermost
+// loops qualify, since Vitis HLS unrolls the loops inside pipelined loops. The
+// loop also needs a preheader to record its entry, dedicated exit blocks to
+// flush its bits, and only branch terminators, whose outcome fits in a bit.
+bool ControlFlowTracePass::isPipelinedLoop(const Loop* loop) {
+  if (pipelinedLoops == PipelinedLoops::None || !loop->getSubLoops().empty())
+    return false;
+
+  if (pipelinedLoops == PipelinedLoops::Marked) {
+    // Vitis HLS attaches 'llvm.loop.pipeline.enable' to the loop metadata.
+    bool marked = false;
+    if (auto loop_id = loop->getLoopID()) {
+      for (unsigned i = 1; i < loop_id->getNumOperands(); i++) {
+        auto node = dyn_cast<MDNode>(loop_id->getOperand(i));
+        if (!node || node->getNumOperands() == 0)
+          continue;
+        auto name = dyn_cast<MDString>(node->getOperand(0));
+        if (name && name->getString() == "llvm.loop.pipeline.enable")
+          marked = true;
+      }
+    }
+    if (!marked)
+      return false;
+  }
+
+  bool qualifies = loop->getLoopPreheader() && loop->hasDedicatedExits();
+  for (auto bb : loop->blocks()) {
+    auto termi = bb->getTerminator();
+    if (!isa<BranchInst>(termi))
+      qualifies = false;
+  }
+  if (!qualifies) {
+    errs() << "Recording pipelined loop at " << loop->getHeader()->getName()
+           << " with site records since it is not in simplified form.\n";
+  }
+  return qualifies;
+}
+
+// Record the branches of pipelined loops as bits. Writing a site record in
+// every iteration puts the update of the trace index on the critical path of
+// the pipeline. Instead, the preheader writes a site record for the loop, each
+// conditional branch in the loop shifts its outcome (1 for the first
+// successor) into a register in the tracer, which is written out once every 27
+// bits, and every exit block flushes the remaining bits. The host replays the
+// iterations from the loop's CFG in the site table.
+void ControlFlowTracePass::instrumentPipelinedLoops(Function& func,
+                                                    const std::vector<Loop*>& loops) {
+  if (loops.empty())
+    return;
+
+  auto recordTracerFunc = getTracerFunction(TracerFunction::Record);
+  assert_(recordTracerFunc, "Cannot find the record tracer function!");
+  auto recordBranchTracerFunc = getTracerFunction(TracerFunction::RecordBranch);
+  assert_(recordBranchTracerFunc, "Cannot find the branch record tracer function!");
+  auto flushBranchesTracerFunc = getTracerFunction(TracerFunction::FlushBranches);
+  assert_(flushBranchesTracerFunc, "Cannot find the flush branches tracer function!");
+
+  IRBuilder<> builder(func.getContext());
+  for (auto loop : loops) {
+    auto header = loop->getHeader();
+    auto loc = getInstructionLocationInfo(header).second;
+    PipelinedLoop graph;
+    graph.site = addTraceSite(header, loc, "pipeline");
+
+    builder.SetInsertPoint(loop->getLoopPreheader()->getTerminator());
+    builder.CreateCall(recordTracerFunc,
+                       {traceArg(func, recordTracerFunc, builder), builder.getInt32(graph.site)});
+
+    // The header comes first in the blocks of a loop.
+    std::map<BasicBlock*, int> index;
+    for (auto bb : loop->blocks()) {
+      index[bb] = graph.blocks.size();
+      graph.blocks.push_back(bb->getName().str());
+      graph.lines.push_back(getInstructionLocationInfo(bb).second->getLine());
+    }
+
+    unsigned branches = 0;
+    for (auto bb : loop->blocks()) {
+      std::vector<int> succs;
+      for (auto succ : successors(bb))
+        succs.push_back(index.count(succ) ? index[succ] : -1);
+      graph.successors.push_back(succs);
+
+      auto termi = cast<BranchInst>(bb->getTerminator());
+      if (!termi->isConditional())
+        continue;
+      builder.SetInsertPoint(termi);
+      auto taken = builder.CreateZExt(termi->getCondition(), builder.getInt32Ty());
+      builder.CreateCall(recordBranchTracerFunc,
+                         {traceArg(func, recordBranchTracerFunc, builder), taken});
+      branches++;
+    }
+
+    SmallVector<BasicBlock*, 4> exit_bbs;
+    loop->getUniqueExitBlocks(exit_bbs);
+    for (auto exit_bb : exit_bbs) {
+      builder.SetInsertPoint(&*exit_bb->getFirstInsertionPt());
+      builder.CreateCall(flushBranchesTracerFunc,
+                         {traceArg(func, flushBranchesTracerFunc, builder)});
+    }
+
+    errs() << "Inserted branch bit records for pipelined loop site " << graph.site
+           << " at " << loc->getFilename() << ":" << loc->getLine() << ":"
+           << loc->getColumn() << " with " << branches << " branch(es)\n";
+    pipelinedLoopGraphs.push_back(graph);
+  }
+}
+
+// Ball-Larus path profiling.
+//
+// Removing back edges makes the CFG a DAG. Each back edge u->v is replaced by
+// two dummy edges, ENTRY->v and u->EXIT, and every block without successors
+// gets an edge to EXIT. Edge values are assigned so that the sum of the values
+// along any ENTRY->EXIT path is a unique number in [0, NumPaths(ENTRY)).
+// A local variable accumulates the values of the edges taken. A path record
+// is written when a back edge is taken (after which the variable is reset to
+// the value of ENTRY->v) and right before the function returns.
+void ControlFlowTracePass::instrumentPaths(Function& func) {
+  auto recordPathTracerFunc = getTracerFunction(TracerFunction::RecordPath);
+  assert_(recordPathTracerFunc, "Cannot find the path record tracer function!");
+
+  // Number the blocks. Index 0 is always the entry block.
+  std::map<BasicBlock*, int> index;
+  std::vector<BasicBlock*> blocks;
+  for (auto& bb : func) {
+    index[&bb] = blocks.size();
+    blocks.push_back(&bb);
+  }
+  const int num_blocks = blocks.size();
+  const int exit_node = num_blocks;
+  const int entry_node = num_blocks + 1;
+
+  // Find back edges with a DFS from the entry. An edge is a back edge if its
+  // destination is still on the DFS stack. Unreachable blocks never execute,
+  // so they are left out of the DAG.
+  std::vector<int> state(num_blocks, 0);  // 0: unvisited, 1: on stack, 2: done
+  std::set<std::pair<int, int>> back_edges;
+  std::vector<std::pair<int, std::vector<int>>> stack;
+  auto distinctSuccessors = [&](int node) {
+    std::vector<int> succs;
+    for (auto succ : successors(blocks[node])) {
+      int s = index[succ];
+      if (std::find(succs.begin(), succs.end(), s) == succs.end())
+        succs.push_back(s);
+    }
+    return succs;
+  };
+  state[0] = 1;
+  stack.push_back({0, distinctSuccessors(0)});
+  while (!stack.empty()) {
+    auto& top = stack.back();
+    if (top.second.empty()) {
+      state[top.first] = 2;
+      stack.pop_back();
+      continue;
+    }
+    int succ = top.second.back();
+    top.second.pop_back();
+    if (state[succ] == 1) {
+      back_edges.insert({top.first, succ});
+    } else if (state[succ] == 0) {
+      state[succ] = 1;
+      stack.push_back({succ, distinctSuccessors(succ)});
+    }
+  }
+
+  // Build the DAG. The edge from ENTRY to the entry block comes first so that
+  // its value is zero.
+  std::vector<std::vector<GraphEdge>> out_edges(num_blocks + 2);
+  out_edges[entry_node].push_back({entry_node, 0, 0, -1});
+  std::set<int> back_edge_targets;
+  for (int node = 0; node < num_blocks; node++) {
+    if (state[node] == 0)
+      continue;
+    auto succs = distinctSuccessors(node);
+    if (succs.empty())
+      out_edges[node].push_back({node, exit_node, 0, -1});
+    for (int succ : succs) {
+      if (back_edges.count({node, succ})) {
+        out_edges[node].push_back({node, exit_node, 0, -1});
+        if (back_edge_targets.insert(succ).second)
+          out_edges[entry_node].push_back({entry_node, succ, 0, -1});
+      } else {
+        out_edges[node].push_back({node, succ, 0, -1});
+      }
+    }
+  }
+
+  // Visit nodes in reverse topological order (DFS postorder over the DAG) and
+  // assign edge values. NumPaths(EXIT) is 1.
+  std::vector<uint64_t> num_paths(num_blocks + 2, 0);
+  std::vector<int> postorder;
+  std::vector<bool> visited(num_blocks + 2, false);
+  std::vector<std::pair<int, size_t>> dag_stack = {{entry_node, 0}};
+  visited[entry_node] = true;
+  while (!dag_stack.empty()) {
+    auto& top = dag_stack.back();
+    if (top.second == out_edges[top.first].size()) {
+      postorder.push_back(top.first);
+      dag_stack.pop_back();
+      continue;
+    }
+    int succ = out_edges[top.first][top.second++].to;
+    if (!visited[succ]) {
+      visited[succ] = true;
+      dag_stack.push_back({succ, 0});
+    }
+  }
+  // Ball-Larus path IDs share the 28-bit payload of a path record with all
+  // other functions.
+  const uint64_t max_paths = CONTROL_FLOW_TRACE_PAYLOAD_MASK + 1ULL;
+  for (int node : postorder) {
+    if (node == exit_node) {
+      num_paths[node] = 1;
+      continue;
+    }
+    for (auto& edge : out_edges[node]) {
+      edge.value = num_paths[node];
+      num_paths[node] += num_paths[edge.to];
+      assert_(num_paths[node] <= max_paths,
+              "Too many acyclic paths for the paths mode. Use another mode.");
+    }
+  }
+
+  FunctionGraph path_func;
+  path_func.path_base = functionGraphs.empty() ? 0
+      : functionGraphs.back().path_base + functionGraphs.back().path_count;
+  path_func.path_count = num_paths[entry_node];
+  assert_(path_func.path_base + path_func.path_count <= max_paths,
+          "Too many acyclic paths for the paths mode. Use another mode.");
+  exportBlocks(func, path_func);
+  for (auto& edges : out_edges) {
+    for (auto& edge : edges) {
+      GraphEdge exported = edge;
+      if (exported.from == entry_node)
+        exported.from = -1;
+      if (exported.to == exit_node)
+        exported.to = -1;
+      exported.counter = -1;
+      path_func.edges.push_back(exported);
+    }
+  }
+
+  // Instrument. All edge values are known before the CFG is changed by
+  // splitting critical edges.
+  IRBuilder<> builder(func.getContext());
+  builder.SetInsertPoint(&*func.getEntryBlock().getFirstInsertionPt());
+  auto path = builder.CreateAlloca(builder.getInt32Ty(), nullptr, "trace.path");
+  builder.CreateStore(builder.getInt32(0), path);
+
+  std::map<int, uint64_t> reset_value;
+  for (auto& edge : out_edges[entry_node])
+    reset_value[edge.to] = edge.value;
+
+  auto addToPath = [&](uint64_t value) {
+    if (value == 0)
+      return;
+    auto current = builder.CreateLoad(builder.getInt32Ty(), path);
+    builder.CreateStore(builder.CreateAdd(current, builder.getInt32(value)), path);
+  };
+  auto recordPath = [&]() {
+    auto current = builder.CreateLoad(builder.getInt32Ty(), path);
+    auto id = builder.CreateAdd(current, builder.getInt32(path_func.path_base));
+    builder.CreateCall(recordPathTracerFunc, {traceArg(func, recordPathTracerFunc, builder), id});
+  };
+
+  for (int node = 0; node < num_blocks; node++) {
+    auto succs = distinctSuccessors(node);
+    for (auto& edge : out_edges[node]) {
+      if (edge.to != exit_node) {
+        // A DAG edge.
+        if (edge.value == 0)
+          continue;
+        builder.SetInsertPoint(getEdgeInsertionPoint(blocks[node], blocks[edge.to]));
+        addToPath(edge.value);
+      }
+    }
+    if (state[node] == 0)
+      continue;
+
+    // Dummy edges to EXIT, in the same order as they were created above.
+    auto exit_edge = out_edges[node].begin();
+    auto nextExitEdge = [&]() {
+      while (exit_edge->to != exit_node)
+        exit_edge++;
+      return *exit_edge++;
+    };
+    if (succs.empty()) {
+      auto edge = nextExitEdge();
+      if (!isa<ReturnInst>(blocks[node]->getTerminator()))
+        continue;
+      builder.SetInsertPoint(blocks[node]->getTerminator());
+      addToPath(edge.value);
+      recordPath();
+    }
+    for (int succ : succs) {
+      if (!back_edges.count({node, succ}))
+        continue;
+      auto edge = nextExitEdge();
+      builder.SetInsertPoint(getEdgeInsertionPoint(blocks[node], blocks[succ]));
+      addToPath(edge.value);
+      recordPath();
+      builder.CreateStore(builder.getInt32(reset_value[succ]), path);
+    }
+  }
+
+  errs() << "Inserted path records in " << path_func.name << " for "
+         << path_func.path_count << " path(s) starting at ID "
+         << path_func.path_base << "\n";
+  functionGraphs.push_back(path_func);
+}
+
+// Edge profiling with optimal counter placement (Knuth).
+//
+// With a virtual edge from EXIT back to the entry block, every node of the CFG
+// conserves flow, so the counts of the edges on any spanning tree follow from
+// the counts of the edges off the tree. Only the edges off a maximum spanning
+// tree are counted. Edge weights are the depth of the innermost loop that
+// contains both ends, so that the hot edges inside loops end up on the tree
+// and go uncounted. The virtual edge always goes on the tree.
+void ControlFlowTracePass::instrumentEdges(Function& func) {
+  auto countTracerFunc = getTracerFunction(TracerFunction::Count);
+  assert_(countTracerFunc, "Cannot find the count tracer function! Build the tracer with "
+                           "CONTROL_FLOW_TRACER_COUNTERS.");
+  auto& loop_info = getAnalysis<LoopInfoWrapperPass>(func).getLoopInfo();
+
+  std::map<BasicBlock*, int> index;
+  std::vector<BasicBlock*> blocks;
+  for (auto& bb : func) {
+    index[&bb] = blocks.size();
+    blocks.push_back(&bb);
+  }
+  const int virtual_node = blocks.size();  // Both ENTRY and EXIT
+
+  // Edges in the order they are exported. Edge 0 is the virtual edge.
+  struct WeightedEdge {
+    int from;
+    int to;
+    unsigned weight;
+  };
+  std::vector<WeightedEdge> edges = {{virtual_node, 0, ~0u}};
+  for (int node = 0; node < (int)blocks.size(); node++) {
+    std::set<int> seen;
+    for (auto succ : successors(blocks[node])) {
+      int to = index[succ];
+      if (!seen.insert(to).second)
+        continue;
+      unsigned weight = std::min(loop_info.getLoopDepth(blocks[node]),
+                                 loop_info.getLoopDepth(succ));
+      edges.push_back({node, to, weight});
+    }
+    if (seen.empty())
+      edges.push_back({node, virtual_node, 0});
+  }
+
+  // Kruskal's algorithm with a union-find over the nodes.
+  std::vector<int> parent(blocks.size() + 1);
+  for (size_t i = 0; i < parent.size(); i++)
+    parent[i] = i;
+  std::function<int(int)> find = [&](int node) {
+    return parent[node] == node ? node : parent[node] = find(parent[node]);
+  };
+  std::vector<size_t> order(edges.size());
+  for (size_t i = 0; i < order.size(); i++)
+    order[i] = i;
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return edges[a].weight > edges[b].weight;
+  });
+  std::vector<bool> on_tree(edges.size(), false);
+  for (size_t i : order) {
+    int a = find(edges[i].from), b = find(edges[i].to);
+    if (a != b) {
+      parent[a] = b;
+      on_tree[i] = true;
+    }
+  }
+
+  FunctionGraph graph;
+  graph.path_base = 0;
+  graph.path_count = 0;
+  exportBlocks(func, graph);
+
+  // Instrument the counted edges. Edges into EXIT are counted right before the
+  // return. Blocks that end in unreachable never complete, so their counters
+  // are never incremented.
+  IRBuilder<> builder(func.getContext());
+  unsigned counted = 0;
+  for (size_t i = 0; i < edges.size(); i++) {
+    const auto& edge = edges[i];
+    int counter = -1;
+    if (!on_tree[i]) {
+      counter = numCounters++;
+      counted++;
+      Instruction* point = nullptr;
+      if (edge.to != virtual_node)
+        point = getEdgeInsertionPoint(blocks[edge.from], blocks[edge.to]);
+      else if (isa<ReturnInst>(blocks[edge.from]->getTerminator()))
+        point = blocks[edge.from]->getTerminator();
+      if (point) {
+        builder.SetInsertPoint(point);
+        builder.CreateCall(countTracerFunc, {builder.getInt32(counter)});
+      }
+    }
+    graph.edges.push_back({edge.from == virtual_node ? -1 : edge.from,
+                           edge.to == virtual_node ? -1 : edge.to, 0, counter});
+  }
+
+  errs() << "Inserted " << counted << " edge counter(s) in " << graph.name
+         << " for " << edges.size() << " edge(s)\n";
+  functionGraphs.push_back(graph);
+}
+
+// Stamp the site and path records of a function with cycle counts. A stamp call
+// reading the clock argument is inserted right before every record call. Does
+// nothing if the function has no clock argument.
+void ControlFlowTracePass::instrumentTimestamps(Function& func) {
+  // A path signature must not depend on timing.
+  if (signature)
+    return;
+
+  std::vector<CallInst*> records;
+  for (auto& bb : func) {
+    for (auto& inst : bb) {
+      auto call = dyn_cast<CallInst>(&inst);
+      if (call && (call->getCalledFunction() == getTracerFunction(TracerFunction::Record)
+                   || call->getCalledFunction() == getTracerFunction(TracerFunction::RecordPath))
+          && !isDetailRecord(call))  // only the coarse level is stamped
+        records.push_back(call);
+    }
+  }
+  if (records.empty())
+    return;
+
+  // Not an error, since the clock argument need not reach every function.
+  auto clock = getClockArg(func);
+  if (!clock)
+    return;
+  auto stampTracerFunc = getTracerFunction(TracerFunction::Stamp);
+  assert_(stampTracerFunc, "Cannot find the stamp tracer function!");
+
+  IRBuilder<> builder(func.getContext());
+  for (auto call : records) {
+    builder.SetInsertPoint(call);
+    builder.CreateCall(stampTracerFunc,
+                       {traceArg(func, stampTracerFunc, builder), readClock(clock, builder)});
+  }
+  errs() << "Inserted " << records.size() << " cycle stamp(s) in "
+         << func.getName() << "\n";
+}
+
+// Find the clock argument of the function. Returns nullptr if there is none.
+Argument* ControlFlowTracePass::getClockArg(Function& func) {
+  auto clock = getArgByName(func, clockArgName);
+  assert_(!clock || isa<PointerType>(clock->getType()),
+          "The clock argument must be a pointer to a volatile integer.");
+  return clock;
+}
+
+// Find the argument of the function with the given name. Returns nullptr if
+// there is none.
+Argument* ControlFlowTracePass::getArgByName(Function& func, StringRef name) {
+  for (auto& arg : func.args()) {
+    if (arg.getName() == name)
+      return &arg;
+  }
+  return nullptr;
+}
+
+// Find the processes of dataflow regions and assign each a channel. A function
+// with a dataflow region is marked with the 'fpga.dataflow.func' attribute (or
+// holds an 'xcl_dataflow' operand bundle), and every instrumented function it
+// calls is a process. Functions called from a process write to the channel of
+// that process. Returns the channel of every function in a process.
+std::map<Function*, int> ControlFlowTracePass::findDataflowProcesses(
+    const std::vector<Function*>& funcs) {
+  std::set<Function*> instrumented(funcs.begin(), funcs.end());
+  auto getCallees = [&instrumented](Function* func) {
+    std::vector<Function*> callees;
+    for (auto& bb : *func) {
+      for (auto& inst : bb) {
+        auto call = dyn_cast<CallInst>(&inst);
+        if (call && instrumented.count(call->getCalledFunction()))
+          callees.push_back(call->getCalledFunction());
+      }
+    }
+    return callees;
+  };
+
+  std::map<Function*, int> channels;
+  for (auto func : funcs) {
+    bool dataflow = func->hasFnAttribute("fpga.dataflow.func");
+    for (auto& bb : *func) {
+      for (auto& inst : bb) {
+        auto call = dyn_cast<CallInst>(&inst);
+        if (call && call->getOperandBundle("xcl_dataflow"))
+          dataflow = true;
+      }
+    }
+    if (!dataflow)
+      continue;
+
+    for (auto process : getCallees(func)) {
+      if (channels.count(process))
+        continue;
+      processes.push_back(process->getName().str());
+      int channel = processes.size();
+      errs() << "Dataflow process " << process->getName() << " writes to channel "
+             << channel << ".\n";
+
+      std::vector<Function*> worklist = {process};
+      channels[process] = channel;
+      while (!worklist.empty()) {
+        auto callee_func = worklist.back();
+        worklist.pop_back();
+        for (auto callee : getCallees(callee_func)) {
+          if (!channels.count(callee)) {
+            channels[callee] = channel;
+            worklist.push_back(callee);
+          } else if (channels[callee] != channel) {
+            errs() << "Warning: " << callee->getName() << " is called from "
+                   << "more than one dataflow process, and writes to channel "
+                   << channels[callee] << " from all of them.\n";
+          }
         }
       }
     }
+  }
+  return channels;
+}
 
-    // Second stage: remove BBs if it ends with a conditional branch.
-    auto remove = std::remove_if(
-        record_candidate_bbs.begin(), record_candidate_bbs.end(),
-        [](BasicBlock* bb) {
-          auto termi = dyn_cast<BranchInst>(bb->getTerminator());
-          return termi && termi->isConditional();
-        });
-    record_candidate_bbs.erase(remove, record_candidate_bbs.end());
+// Redirect the records of dataflow processes to their own channels. The trace
+// data region is split into a power-of-two number of equal slices. Slice 0 is
+// used by everything outside of dataflow processes, and slice c by channel c.
+// Each channel has its own cursor, so that the processes share no tracer state
+// and can still run in parallel.
+void ControlFlowTracePass::instrumentProcesses(const std::map<Function*, int>& channels,
+                                               int array_size) {
+  assert_(traceMode != TraceMode::Edges,
+          "Edges mode does not support dataflow processes, since all edge counters "
+          "are in one shared array.");
+  assert_(traceMode != TraceMode::Branches,
+          "Branches mode does not support dataflow processes, since all branch "
+          "bits go through one shared register.");
+  assert_(processes.size() < maxChannels,
+          "Too many dataflow processes. Increase CONTROL_FLOW_TRACER_MAX_CHANNELS "
+          "and -controlflowtrace-max-channels.");
+  int slices = 1;
+  while (slices < (int)processes.size() + 1)
+    slices <<= 1;
+  channelSlice = (array_size - 4) / slices;
+  assert_(channelSlice >= 2, "The trace array is too small to give every dataflow "
+                             "process its own slice.");
+  errs() << "Splitting the trace array into " << slices << " slices of "
+         << channelSlice << " entries.\n";
 
-    // Insert tracer function call at the first location of each target BB.
-    auto recordTracerFunc = getTracerFunction(TracerFunction::Record);
-    assert_(recordTracerFunc, "Cannot find the record tracer function!");
-    for (auto bb : record_candidate_bbs) {
-      auto inst = getInstructionLocationInfo(bb);
+  auto channelRecordTracerFunc = getTracerFunction(TracerFunction::ChannelRecord);
+  assert_(channelRecordTracerFunc, "Cannot find the channel record tracer function! Build "
+                                   "the tracer with CONTROL_FLOW_TRACER_CHANNELS.");
+  auto channelStampTracerFunc = getTracerFunction(TracerFunction::ChannelStamp);
+  assert_(channelStampTracerFunc, "Cannot find the channel stamp tracer function!");
+  auto channelFinishTracerFunc = getTracerFunction(TracerFunction::ChannelFinish);
+  assert_(channelFinishTracerFunc, "Cannot find the channel finish tracer function!");
+  auto stampTracerFunc = getTracerFunction(TracerFunction::Stamp);
+  auto recordBranchTracerFunc = getTracerFunction(TracerFunction::RecordBranch);
 
-      ArrayRef<Value*> args = {func.getArg(0),
-                               builder.getInt32(inst.second->getLine()),
-                               builder.getInt32(inst.second->getColumn())};
+  IRBuilder<> builder(channelRecordTracerFunc->getContext());
+  for (auto& entry : channels) {
+    Function* func = entry.first;
+    Value* channel = builder.getInt32(entry.second);
+    Value* slice = builder.getInt32(channelSlice);
 
-      builder.SetInsertPoint(inst.first);
-      builder.CreateCall(recordTracerFunc, args);
+    std::vector<CallInst*> calls;
+    std::vector<ReturnInst*> returns;
+    for (auto& bb : *func) {
+      for (auto& inst : bb) {
+        if (auto call = dyn_cast<CallInst>(&inst)) {
+          auto callee = call->getCalledFunction();
+          assert_(!callee || callee != recordBranchTracerFunc,
+                  "Dataflow processes cannot record branches as bits. Pass "
+                  "-controlflowtrace-pipelined-loops=none.");
+          if (callee && (getRecordTag(callee) != -1 || callee == stampTracerFunc))
+            calls.push_back(call);
+        } else if (auto ret = dyn_cast<ReturnInst>(&inst)) {
+          returns.push_back(ret);
+        }
+      }
+    }
 
-      errs() << "Inserted record function at " << inst.second->getFilename()
-             << ":" << inst.second->getLine() << ":" << inst.second->getColumn()
-             << "\n";
+    for (auto call : calls) {
+      builder.SetInsertPoint(call);
+      auto callee = call->getCalledFunction();
+      if (callee == stampTracerFunc) {
+        builder.CreateCall(channelStampTracerFunc,
+                           {call->getArgOperand(0), channel, slice, call->getArgOperand(1)});
+      } else {
+        builder.CreateCall(channelRecordTracerFunc,
+                           {call->getArgOperand(0), channel, slice,
+                            builder.getInt32(getRecordTag(callee)), call->getArgOperand(1)});
+      }
+      call->eraseFromParent();
+    }
+
+    // Only the process itself marks the end of its channel.
+    if (std::find(processes.begin(), processes.end(), func->getName().str())
+        == processes.end())
+      continue;
+    // Stamp the end so that the last record of the process gets its cycles.
+    auto clock = getClockArg(*func);
+    for (auto ret : returns) {
+      builder.SetInsertPoint(ret);
+      if (clock) {
+        builder.CreateCall(channelStampTracerFunc,
+                           {func->getArg(0), channel, slice, readClock(clock, builder)});
+      }
+      builder.CreateCall(channelFinishTracerFunc, {func->getArg(0), channel, slice});
     }
   }
+}
 
-  return true;
+// The tag of the records written by a record, trip, or path tracer function.
+// Returns -1 for any other function.
+int ControlFlowTracePass::getRecordTag(const Function* callee) {
+  if (!callee)
+    return -1;
+  if (callee == getTracerFunction(TracerFunction::Record))
+    return CONTROL_FLOW_TRACE_TAG_SITE;
+  if (callee == getTracerFunction(TracerFunction::RecordTrip))
+    return CONTROL_FLOW_TRACE_TAG_TRIP;
+  if (callee == getTracerFunction(TracerFunction::RecordPath))
+    return CONTROL_FLOW_TRACE_TAG_PATH;
+  if (callee == getTracerFunction(TracerFunction::RecordCall))
+    return CONTROL_FLOW_TRACE_TAG_CALL;
+  if (callee == getTracerFunction(TracerFunction::RecordReturn))
+    return CONTROL_FLOW_TRACE_TAG_RETURN;
+  return -1;
+}
+
+// Replace the record, trip, path, and stamp calls in every function with calls
+// to the record and stamp functions of another tracer variant. The record
+// function takes the tag of the replaced call, and both take the first
+// argument of the function as their output, cast to the type they expect,
+// unless the record function only takes the tag and the payload, like the fold
+// function of path signatures. stamp_func may be null if there are no stamp
+// calls.
+void ControlFlowTracePass::redirectRecords(const std::vector<Function*>& funcs,
+                                           Function* record_func, Function* stamp_func) {
+  auto stampTracerFunc = getTracerFunction(TracerFunction::Stamp);
+
+  IRBuilder<> builder(record_func->getContext());
+  for (auto func : funcs) {
+    std::vector<CallInst*> calls;
+    for (auto& bb : *func) {
+      for (auto& inst : bb) {
+        auto call = dyn_cast<CallInst>(&inst);
+        if (!call)
+          continue;
+        auto callee = call->getCalledFunction();
+        if (callee && (getRecordTag(callee) != -1 || callee == stampTracerFunc))
+          calls.push_back(call);
+      }
+    }
+
+    for (auto call : calls) {
+      builder.SetInsertPoint(call);
+      auto callee = call->getCalledFunction();
+      if (callee == stampTracerFunc) {
+        auto output = builder.CreatePointerCast(func->getArg(0),
+                                                stamp_func->getFunctionType()->getParamType(0));
+        builder.CreateCall(stamp_func, {output, call->getArgOperand(1)});
+      } else {
+        std::vector<Value*> args = {builder.getInt32(getRecordTag(callee)),
+                                    call->getArgOperand(1)};
+        if (record_func->arg_size() > 2) {
+          args.insert(args.begin(),
+                      builder.CreatePointerCast(func->getArg(0),
+                                                record_func->getFunctionType()->getParamType(0)));
+        }
+        builder.CreateCall(record_func, args);
+      }
+      auto trace_cast = dyn_cast<Instruction>(call->getArgOperand(0));
+      call->eraseFromParent();
+      if (trace_cast && trace_cast->use_empty())
+        trace_cast->eraseFromParent();
+    }
+  }
+}
+
+// Push all records into the hls::stream that is the first argument of the
+// top-level function, instead of writing them to a trace array. The record,
+// trip, path, and stamp calls in every function are replaced with their
+// stream counterparts. The top-level function starts the clock and pushes the
+// end record.
+void ControlFlowTracePass::instrumentStream(const std::vector<Function*>& funcs,
+                                           Function& top_func) {
+  errs() << "Trace goes to the stream '" << top_func.getArg(0)->getName() << "'.\n";
+  assert_(traceMode != TraceMode::Edges,
+          "Edges mode needs a trace array to copy the counters to.");
+  assert_(traceMode != TraceMode::Branches,
+          "Branches mode does not support trace streams.");
+  assert_(processes.empty(),
+          "Dataflow processes cannot share one trace stream.");
+  assert_(pipelinedLoopGraphs.empty(),
+          "Branches cannot be recorded as bits with a trace stream. Pass "
+          "-controlflowtrace-pipelined-loops=none.");
+  assert_(!histogram, "The site histogram needs a trace array to copy the counts to.");
+
+  auto streamRecordTracerFunc = getTracerFunction(TracerFunction::StreamRecord);
+  assert_(streamRecordTracerFunc, "Cannot find the stream record tracer function!");
+  auto streamStampTracerFunc = getTracerFunction(TracerFunction::StreamStamp);
+  assert_(streamStampTracerFunc, "Cannot find the stream stamp tracer function!");
+  redirectRecords(funcs, streamRecordTracerFunc, streamStampTracerFunc);
+
+  IRBuilder<> builder(top_func.getContext());
+
+  // Latch the clock so that the first stamp counts from the start.
+  auto clock = getClockArg(top_func);
+  if (clock) {
+    auto streamStartClockTracerFunc = getTracerFunction(TracerFunction::StreamStartClock);
+    assert_(streamStartClockTracerFunc, "Cannot find the stream start clock tracer function!");
+    builder.SetInsertPoint(&*top_func.getEntryBlock().getFirstInsertionPt());
+    builder.CreateCall(streamStartClockTracerFunc, {readClock(clock, builder)});
+  }
+
+  // Push the end record before each return of the top-level function.
+  auto streamFinishTracerFunc = getTracerFunction(TracerFunction::StreamFinish);
+  assert_(streamFinishTracerFunc, "Cannot find the stream finish tracer function!");
+  for (auto& bb : top_func) {
+    auto ret = dyn_cast<ReturnInst>(bb.getTerminator());
+    if (!ret)
+      continue;
+    builder.SetInsertPoint(ret);
+    if (clock) {
+      builder.CreateCall(streamStampTracerFunc, {top_func.getArg(0), readClock(clock, builder)});
+    }
+    builder.CreateCall(streamFinishTracerFunc, {top_func.getArg(0)});
+    errs() << "Inserted stream finish function.\n";
+  }
+}
+
+// Whether the first argument of the function is a trace array of words wider
+// than a record, e.g. ap_uint<512> for a 512-bit m_axi port. Vitis HLS lowers
+// ap_uint<W> to a struct named after it, or to a plain iW.
+bool ControlFlowTracePass::isWideTraceArray(Function& func) {
+  auto trace_type = dyn_cast<PointerType>(func.getArg(0)->getType());
+  if (!trace_type)
+    return false;
+  auto trace_elem = trace_type->getElementType();
+  if (auto int_type = dyn_cast<IntegerType>(trace_elem))
+    return int_type->getBitWidth() > 32;
+  auto struct_type = dyn_cast<StructType>(trace_elem);
+  return struct_type && struct_type->hasName() && struct_type->getName().contains("ap_uint<");
+}
+
+// Write all records to a trace array of wide words through
+// control-flow-tracer-wide.cpp, which packs them into a word-wide shift
+// register and writes one full word at a time. The record, trip, path, and
+// stamp calls in every function are replaced with their wide counterparts.
+// The top-level function initializes the wide tracer with the array size in
+// words, starts the clock, and writes the last partial word and the tail.
+void ControlFlowTracePass::instrumentWide(const std::vector<Function*>& funcs,
+                                         Function& top_func) {
+  errs() << "Trace goes to the wide array '" << top_func.getArg(0)->getName() << "'.\n";
+  assert_(traceMode != TraceMode::Edges && traceMode != TraceMode::Branches,
+          "Edges and branches mode do not support wide trace arrays.");
+  assert_(processes.empty(),
+          "Dataflow processes cannot share one wide trace array.");
+  assert_(pipelinedLoopGraphs.empty(),
+          "Branches cannot be recorded as bits with a wide trace array. Pass "
+          "-controlflowtrace-pipelined-loops=none.");
+  assert_(!histogram, "Wide trace arrays do not support the site histogram.");
+
+  auto wideRecordTracerFunc = getTracerFunction(TracerFunction::WideRecord);
+  assert_(wideRecordTracerFunc, "Cannot find the wide record tracer function!");
+  auto wideStampTracerFunc = getTracerFunction(TracerFunction::WideStamp);
+  assert_(wideStampTracerFunc, "Cannot find the wide stamp tracer function!");
+  redirectRecords(funcs, wideRecordTracerFunc, wideStampTracerFunc);
+
+  IRBuilder<> builder(top_func.getContext());
+  int array_size = getTraceArraySize(top_func);
+  errs() << "Wide trace array size is " << array_size << " words.\n";
+  auto wideInitTracerFunc = getTracerFunction(TracerFunction::WideInit);
+  assert_(wideInitTracerFunc, "Cannot find the wide init tracer function!");
+  builder.SetInsertPoint(&*top_func.getEntryBlock().getFirstInsertionPt());
+  builder.CreateCall(wideInitTracerFunc, {builder.getInt32(array_size)});
+
+  // Latch the clock so that the first stamp counts from the start.
+  auto clock = getClockArg(top_func);
+  if (clock) {
+    auto wideStartClockTracerFunc = getTracerFunction(TracerFunction::WideStartClock);
+    assert_(wideStartClockTracerFunc, "Cannot find the wide start clock tracer function!");
+    builder.CreateCall(wideStartClockTracerFunc, {readClock(clock, builder)});
+  }
+
+  // Write the last word and the tail before each return of the top-level
+  // function.
+  auto wideFinishTracerFunc = getTracerFunction(TracerFunction::WideFinish);
+  assert_(wideFinishTracerFunc, "Cannot find the wide finish tracer function!");
+  auto array = top_func.getArg(0);
+  for (auto& bb : top_func) {
+    auto ret = dyn_cast<ReturnInst>(bb.getTerminator());
+    if (!ret)
+      continue;
+    builder.SetInsertPoint(ret);
+    if (clock) {
+      auto output = builder.CreatePointerCast(
+          array, wideStampTracerFunc->getFunctionType()->getParamType(0));
+      builder.CreateCall(wideStampTracerFunc, {output, readClock(clock, builder)});
+    }
+    auto output = builder.CreatePointerCast(
+        array, wideFinishTracerFunc->getFunctionType()->getParamType(0));
+    builder.CreateCall(wideFinishTracerFunc, {output});
+    errs() << "Inserted wide finish function.\n";
+  }
+}
+
+// Fold all records into the signature of the path that the invocation takes,
+// instead of writing them, so that the host can bucket many invocations by
+// their paths from two words each. The record, trip, path, call, and return
+// calls in every function are replaced with fold calls of their tag and
+// payload. Branch bits and switch targets are folded one at a time, since a
+// fold is as cheap as the shift that collects them. The top-level function
+// resets the signature and writes it with the number of records folded into
+// it to the first two entries of the trace array.
+void ControlFlowTracePass::instrumentSignature(const std::vector<Function*>& funcs,
+                                              Function& top_func) {
+  errs() << "Trace array '" << top_func.getArg(0)->getName() << "' gets a path signature.\n";
+  assert_(traceMode != TraceMode::Edges, "Edges mode counts edges instead of recording them.");
+  auto trace_type = dyn_cast<PointerType>(top_func.getArg(0)->getType());
+  assert_(trace_type && trace_type->getElementType()->isIntegerTy(32),
+          "Path signatures are written to an int trace array.");
+  assert_(getTraceArraySize(top_func) >= 2,
+          "The trace array must have room for the signature and the record count.");
+  assert_(processes.empty(),
+          "Dataflow processes cannot share one path signature.");
+  assert_(!histogram && !hierarchical && !packSites,
+          "Path signatures do not support the site histogram, hierarchical "
+          "tracing, or packed sites.");
+
+  auto foldTracerFunc = getTracerFunction(TracerFunction::Fold);
+  assert_(foldTracerFunc, "Cannot find the fold tracer function! Build the tracer with "
+                          "CONTROL_FLOW_TRACER_SIGNATURE.");
+  auto recordBranchTracerFunc = getTracerFunction(TracerFunction::RecordBranch);
+  auto flushBranchesTracerFunc = getTracerFunction(TracerFunction::FlushBranches);
+  auto recordTargetTracerFunc = getTracerFunction(TracerFunction::RecordTarget);
+
+  IRBuilder<> builder(top_func.getContext());
+  for (auto func : funcs) {
+    std::vector<CallInst*> calls;
+    for (auto& bb : *func) {
+      for (auto& inst : bb) {
+        auto call = dyn_cast<CallInst>(&inst);
+        if (!call || !call->getCalledFunction())
+          continue;
+        auto callee = call->getCalledFunction();
+        if (callee == recordBranchTracerFunc || callee == flushBranchesTracerFunc
+            || callee == recordTargetTracerFunc)
+          calls.push_back(call);
+      }
+    }
+
+    for (auto call : calls) {
+      builder.SetInsertPoint(call);
+      auto callee = call->getCalledFunction();
+      if (callee != flushBranchesTracerFunc) {
+        int tag = callee == recordBranchTracerFunc ? CONTROL_FLOW_TRACE_TAG_BRANCHES
+                                                   : CONTROL_FLOW_TRACE_TAG_TARGET;
+        builder.CreateCall(foldTracerFunc, {builder.getInt32(tag), call->getArgOperand(1)});
+      }
+      call->eraseFromParent();
+    }
+  }
+  redirectRecords(funcs, foldTracerFunc, nullptr);
+
+  auto initSignatureTracerFunc = getTracerFunction(TracerFunction::InitSignature);
+  assert_(initSignatureTracerFunc, "Cannot find the init signature tracer function!");
+  builder.SetInsertPoint(&*top_func.getEntryBlock().getFirstInsertionPt());
+  builder.CreateCall(initSignatureTracerFunc, {});
+
+  auto finishSignatureTracerFunc = getTracerFunction(TracerFunction::FinishSignature);
+  assert_(finishSignatureTracerFunc, "Cannot find the finish signature tracer function!");
+  for (auto& bb : top_func) {
+    auto ret = dyn_cast<ReturnInst>(bb.getTerminator());
+    if (!ret)
+      continue;
+    builder.SetInsertPoint(ret);
+    builder.CreateCall(finishSignatureTracerFunc, {top_func.getArg(0)});
+    errs() << "Inserted finish signature function.\n";
+  }
+}
+
+// Give every instrumented function a region, whose bit in the enable mask
+// decides whether the function records. The region is entered at the top of
+// the function, and entered again after every call to another instrumented
+// function, since the callee switches to its own region.
+void ControlFlowTracePass::instrumentRegions(const std::vector<Function*>& funcs) {
+  auto enterTracerFunc = getTracerFunction(TracerFunction::Enter);
+  assert_(enterTracerFunc, "Cannot find the enter tracer function!");
+  std::set<Function*> instrumented(funcs.begin(), funcs.end());
+
+  IRBuilder<> builder(enterTracerFunc->getContext());
+  for (auto func : funcs) {
+    int region = std::min<int>(regions.size(), 31);
+    auto subprogram = func->getSubprogram();
+    regions.push_back((subprogram ? subprogram->getName() : func->getName()).str());
+
+    std::vector<CallInst*> calls;
+    for (auto& bb : *func) {
+      for (auto& inst : bb) {
+        auto call = dyn_cast<CallInst>(&inst);
+        if (call && instrumented.count(call->getCalledFunction()))
+          calls.push_back(call);
+      }
+    }
+    for (auto call : calls) {
+      builder.SetInsertPoint(call->getNextNode());
+      builder.CreateCall(enterTracerFunc, {builder.getInt32(region)});
+    }
+    builder.SetInsertPoint(&*func->getEntryBlock().getFirstInsertionPt());
+    builder.CreateCall(enterTracerFunc, {builder.getInt32(region)});
+  }
+  errs() << "Assigned enable mask bits to " << regions.size() << " region(s).\n";
+}
+
+// Read the current cycle count through the clock argument at the builder's
+// insertion point. The load is volatile so that it is neither hoisted nor
+// merged with other reads of the clock.
+Value* ControlFlowTracePass::readClock(Argument* clock, IRBuilder<>& builder) {
+  auto type = cast<PointerType>(clock->getType())->getElementType();
+  auto now = builder.CreateLoad(type, clock);
+  now->setVolatile(true);
+  return builder.CreateZExtOrTrunc(now, builder.getInt32Ty());
+}
+
+// Fill in the function name and the names and first lines of all blocks.
+void ControlFlowTracePass::exportBlocks(Function& func, FunctionGraph& graph) {
+  auto subprogram = func.getSubprogram();
+  graph.name = (subprogram ? subprogram->getName() : func.getName()).str();
+  for (auto& bb : func) {
+    graph.blocks.push_back(bb.getName().str());
+    unsigned line = 0;
+    for (auto& inst : bb) {
+      if (auto loc = inst.getDebugLoc().get()) {
+        line = loc->getLine();
+        break;
+      }
+    }
+    graph.lines.push_back(line);
+  }
+}
+
+// Record every conditional branch as a bit, like the TNT packets of processor
+// trace, instead of a site record for its successor. The outcome (1 for the
+// first successor) is shifted into a register in the tracer, which is written
+// out once every 27 bits. A switch writes a target record with the index of
+// its successor, and the entry of the function writes a site record. Both
+// flush the bits before them, so that the host sees all records in order. The
+// CFG of the function is exported, and the host replays the records over it,
+// entering callees on their entry records, to rebuild every block executed.
+void ControlFlowTracePass::instrumentBranches(Function& func) {
+  auto recordTracerFunc = getTracerFunction(TracerFunction::Record);
+  assert_(recordTracerFunc, "Cannot find the record tracer function!");
+  auto recordBranchTracerFunc = getTracerFunction(TracerFunction::RecordBranch);
+  assert_(recordBranchTracerFunc, "Cannot find the branch record tracer function!");
+  auto flushBranchesTracerFunc = getTracerFunction(TracerFunction::FlushBranches);
+  assert_(flushBranchesTracerFunc, "Cannot find the flush branches tracer function!");
+  auto recordTargetTracerFunc = getTracerFunction(TracerFunction::RecordTarget);
+  assert_(recordTargetTracerFunc, "Cannot find the target record tracer function!");
+
+  FunctionGraph graph;
+  exportBlocks(func, graph);
+  std::map<BasicBlock*, int> index;
+  int num_blocks = 0;
+  for (auto& bb : func)
+    index[&bb] = num_blocks++;
+
+  IRBuilder<> builder(func.getContext());
+  unsigned branches = 0, switches = 0;
+  for (auto& bb : func) {
+    std::vector<int> succs;
+    for (auto succ : successors(&bb))
+      succs.push_back(index[succ]);
+    graph.successors.push_back(succs);
+
+    // The host enters a callee of this block on every entry record it sees
+    // while the block still has calls left.
+    int calls = 0;
+    for (auto& inst : bb) {
+      auto call = dyn_cast<CallInst>(&inst);
+      if (call && call->getCalledFunction() && isInstrumented(*call->getCalledFunction()))
+        calls++;
+    }
+    graph.calls.push_back(calls);
+
+    auto termi = bb.getTerminator();
+    graph.targets.push_back(isa<SwitchInst>(termi));
+    builder.SetInsertPoint(termi);
+    if (auto branch = dyn_cast<BranchInst>(termi)) {
+      if (!branch->isConditional())
+        continue;
+      auto taken = builder.CreateZExt(branch->getCondition(), builder.getInt32Ty());
+      builder.CreateCall(recordBranchTracerFunc,
+                         {traceArg(func, recordBranchTracerFunc, builder), taken});
+      branches++;
+    } else if (auto switch_inst = dyn_cast<SwitchInst>(termi)) {
+      // Successor 0 is the default destination, and case i goes to successor
+      // i + 1.
+      Value* target = builder.getInt32(0);
+      for (auto& case_handle : switch_inst->cases()) {
+        auto matches = builder.CreateICmpEQ(switch_inst->getCondition(),
+                                            case_handle.getCaseValue());
+        target = builder.CreateSelect(
+            matches, builder.getInt32(case_handle.getSuccessorIndex()), target);
+      }
+      builder.CreateCall(recordTargetTracerFunc,
+                         {traceArg(func, recordTargetTracerFunc, builder), target});
+      switches++;
+    } else {
+      assert_(termi->getNumSuccessors() == 0,
+              "Branches mode only supports branch and switch terminators.");
+    }
+  }
+
+  auto entry = &func.getEntryBlock();
+  auto loc = getInstructionLocationInfo(entry).second;
+  graph.site = addTraceSite(entry, loc, "function");
+  builder.SetInsertPoint(&*entry->getFirstInsertionPt());
+  builder.CreateCall(flushBranchesTracerFunc, {traceArg(func, flushBranchesTracerFunc, builder)});
+  builder.CreateCall(recordTracerFunc,
+                     {traceArg(func, recordTracerFunc, builder), builder.getInt32(graph.site)});
+  functionGraphs.push_back(graph);
+
+  errs() << "Inserted branch records for " << func.getName() << " with entry site "
+         << graph.site << ", " << branches << " branch(es), and " << switches
+         << " switch(es)\n";
+}
+
+// Find where to insert code that must only execute when the edge from->to is
+// taken. Critical edges are split.
+Instruction* ControlFlowTracePass::getEdgeInsertionPoint(BasicBlock* from,
+                                                         BasicBlock* to) {
+  if (from->getSingleSuccessor() == to)
+    return from->getTerminator();
+  if (to->getSinglePredecessor() == from)
+    return &*to->getFirstInsertionPt();
+  return SplitEdge(from, to)->getTerminator();
+}
+
+// Assign the next dense site ID to a record location and remember where it
+// came from, so that the host can map trace records back to the source.
+int ControlFlowTracePass::addTraceSite(const BasicBlock* bb,
+                                       const DILocation* loc,
+                                       const char* kind) {
+  const Function* func = bb->getParent();
+  auto subprogram = func->getSubprogram();
+
+  TraceSite site;
+  site.file = loc->getFilename().str();
+  site.function = (subprogram ? subprogram->getName() : func->getName()).str();
+  site.line = loc->getLine();
+  site.column = loc->getColumn();
+  site.block = bb->getName().str();
+  site.kind = kind;
+
+  traceSites.push_back(site);
+  return traceSites.size() - 1;
+}
+
+// Write a JSON string literal, escaping the characters JSON requires.
+static void writeJsonString(raw_ostream& os, StringRef str) {
+  os << '"';
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      os << '\\' << c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      os << "\\u00";
+      os.write_hex(static_cast<unsigned char>(c) >> 4);
+      os.write_hex(c & 0xf);
+    } else {
+      os << c;
+    }
+  }
+  os << '"';
+}
+
+// Dump the site table as JSON. The path is taken from the environment variable
+// HLS_TRACER_SITE_TABLE, which is also read by the testbench to decode traces.
+void ControlFlowTracePass::writeSiteTable() {
+  const char* path = std::getenv("HLS_TRACER_SITE_TABLE");
+  if (!path)
+    path = "control-flow-sites.json";
+
+  std::error_code ec;
+  raw_fd_ostream os(path, ec, sys::fs::OpenFlags::F_Text);
+  assert_(!ec, "Failed to open the site table for writing.");
+
+  static const char* mode_names[] = {"blocks", "loops", "paths", "edges", "branches"};
+  os << "{\n  \"mode\": \"" << mode_names[static_cast<int>(traceMode.getValue())]
+     << "\",\n  \"sites\": [";
+  for (size_t id = 0; id < traceSites.size(); id++) {
+    const TraceSite& site = traceSites[id];
+    os << (id ? ",\n" : "\n") << "    {\"id\": " << id << ", \"file\": ";
+    writeJsonString(os, site.file);
+    os << ", \"function\": ";
+    writeJsonString(os, site.function);
+    os << ", \"line\": " << site.line << ", \"column\": " << site.column
+       << ", \"block\": ";
+    writeJsonString(os, site.block);
+    os << ", \"kind\": ";
+    writeJsonString(os, site.kind);
+    os << "}";
+  }
+  os << "\n  ]";
+
+  // Control flow graphs of the loops whose branches are recorded as bits.
+  if (!pipelinedLoopGraphs.empty()) {
+    os << ",\n  \"pipelines\": [";
+    for (size_t i = 0; i < pipelinedLoopGraphs.size(); i++) {
+      const PipelinedLoop& graph = pipelinedLoopGraphs[i];
+      os << (i ? ",\n" : "\n") << "    {\"site\": " << graph.site << ",\n";
+      os << "     \"blocks\": [";
+      for (size_t b = 0; b < graph.blocks.size(); b++) {
+        os << (b ? ", " : "") << "{\"block\": ";
+        writeJsonString(os, graph.blocks[b]);
+        os << ", \"line\": " << graph.lines[b] << ", \"successors\": [";
+        for (size_t e = 0; e < graph.successors[b].size(); e++)
+          os << (e ? ", " : "") << graph.successors[b][e];
+        os << "]}";
+      }
+      os << "]}";
+    }
+    os << "\n  ]";
+  }
+
+  // Calls to instrumented functions, indexed by the payload of their call and
+  // return records.
+  if (!callSites.empty()) {
+    os << ",\n  \"calls\": [";
+    for (size_t i = 0; i < callSites.size(); i++) {
+      const CallSite& call_site = callSites[i];
+      os << (i ? ",\n" : "\n") << "    {\"file\": ";
+      writeJsonString(os, call_site.file);
+      os << ", \"function\": ";
+      writeJsonString(os, call_site.function);
+      os << ", \"line\": " << call_site.line << ", \"column\": " << call_site.column
+         << ", \"callee\": ";
+      writeJsonString(os, call_site.callee);
+      os << "}";
+    }
+    os << "\n  ]";
+  }
+
+  // The width of packed site records.
+  if (siteBits)
+    os << ",\n  \"site_bits\": " << siteBits;
+
+  // Where the site histogram starts, and where the records wrap.
+  if (histogramOffset) {
+    os << ",\n  \"channel_slice\": " << channelSlice
+       << ",\n  \"histogram_offset\": " << histogramOffset;
+  }
+
+  // The trace array holds a path signature instead of records.
+  if (signature)
+    os << ",\n  \"signature\": true";
+
+  // Where the detail slice starts, which is also where the other records wrap.
+  if (detailSlice)
+    os << ",\n  \"channel_slice\": " << channelSlice << ",\n  \"detail_slice\": true";
+
+  // Dataflow processes in the order of their channels, starting from one.
+  if (!processes.empty()) {
+    os << ",\n  \"channel_slice\": " << channelSlice << ",\n  \"processes\": [";
+    for (size_t i = 0; i < processes.size(); i++) {
+      os << (i ? ", " : "");
+      writeJsonString(os, processes[i]);
+    }
+    os << "]";
+  }
+
+  // Functions in the order of their enable mask bits.
+  if (!regions.empty()) {
+    os << ",\n  \"regions\": [";
+    for (size_t i = 0; i < regions.size(); i++) {
+      os << (i ? ", " : "");
+      writeJsonString(os, regions[i]);
+    }
+    os << "]";
+  }
+
+  // Control flow graphs of the functions instrumented in paths, edges, or
+  // branches mode.
+  if (!functionGraphs.empty()) {
+    os << ",\n  \"functions\": [";
+    for (size_t i = 0; i < functionGraphs.size(); i++) {
+      const FunctionGraph& graph = functionGraphs[i];
+      os << (i ? ",\n" : "\n") << "    {\"name\": ";
+      writeJsonString(os, graph.name);
+      if (traceMode == TraceMode::Paths) {
+        os << ", \"path_base\": " << graph.path_base
+           << ", \"path_count\": " << graph.path_count;
+      } else if (traceMode == TraceMode::Branches) {
+        os << ", \"site\": " << graph.site;
+      }
+      os << ",\n";
+      os << "     \"blocks\": [";
+      for (size_t b = 0; b < graph.blocks.size(); b++) {
+        os << (b ? ", " : "") << "{\"block\": ";
+        writeJsonString(os, graph.blocks[b]);
+        os << ", \"line\": " << graph.lines[b];
+        if (traceMode == TraceMode::Branches) {
+          os << ", \"successors\": [";
+          for (size_t e = 0; e < graph.successors[b].size(); e++)
+            os << (e ? ", " : "") << graph.successors[b][e];
+          os << "], \"calls\": " << graph.calls[b];
+          if (graph.targets[b])
+            os << ", \"targets\": true";
+        }
+        os << "}";
+      }
+      os << "],\n     \"edges\": [";
+      for (size_t e = 0; e < graph.edges.size(); e++) {
+        const GraphEdge& edge = graph.edges[e];
+        os << (e ? ", " : "") << "{\"from\": " << edge.from << ", \"to\": "
+           << edge.to;
+        if (traceMode == TraceMode::Edges)
+          os << ", \"counter\": " << edge.counter << "}";
+        else
+          os << ", \"value\": " << edge.value << "}";
+      }
+      os << "]}";
+    }
+    os << "\n  ]";
+  }
+  os << "\n}\n";
+
+  errs() << "Wrote " << traceSites.size() << " trace sites to " << path
+         << ".\n";
 }
 
 // Find the first instruction beginning from the top of the given basic block
@@ -217,6 +2637,40 @@ int ControlFlowTracePass::getTracerFunctions(
   return function_num;
 }
 
+// The name of a tracer function as declared, and the rest of its mangled name,
+// which starts with the template arguments of a templated tracer function. The
+// plain, stream, and wide tracers have C names, which have no rest.
+static std::pair<std::string, std::string> splitTracerName(StringRef name) {
+  StringRef rest = name;
+  unsigned long long length = 0;
+  if (!rest.consume_front("_Z") || rest.consumeInteger(10, length) || length > rest.size())
+    return {name.str(), ""};
+  return {rest.take_front(length).str(), rest.drop_front(length).str()};
+}
+
+// The templated tracer is instantiated for one trace array size at a time, and
+// the size is the first template argument in the mangled names of its
+// functions, e.g. controlFlowTracerRecordILi260E. If it is linked, only the
+// functions of the instantiation for the trace array of the top-level function
+// are used.
+void ControlFlowTracePass::selectTracerInstantiation(Function& top_func) {
+  bool templated = false;
+  for (auto& entry : tracerFunctions) {
+    auto name = splitTracerName(entry.first);
+    if (name.first == "controlFlowTracerInit" && StringRef(name.second).startswith("I"))
+      templated = true;
+  }
+  if (!templated)
+    return;
+
+  int array_size = getTraceArraySize(top_func);
+  tracerInstantiation = "ILi" + std::to_string(array_size) + "E";
+  assert_(getTracerFunction(TracerFunction::Init),
+          "The templated tracer is not instantiated for the size of the trace array. "
+          "Rebuild it with TRACER_FLAGS=-DCONTROL_FLOW_TRACER_SIZE=<size>.");
+  errs() << "Using the templated tracer for " << array_size << " entries.\n";
+}
+
 Function* ControlFlowTracePass::getTracerFunction(
     const TracerFunction tracerFunc) {
   Function* func = nullptr;
@@ -225,21 +2679,96 @@ Function* ControlFlowTracePass::getTracerFunction(
     key = "TracerInit";
   else if (tracerFunc == TracerFunction::Record)
     key = "TracerRecord";
+  else if (tracerFunc == TracerFunction::RecordTrip)
+    key = "TracerRecordTrip";
+  else if (tracerFunc == TracerFunction::RecordPath)
+    key = "TracerRecordPath";
+  else if (tracerFunc == TracerFunction::RecordBranch)
+    key = "TracerRecordBranch";
+  else if (tracerFunc == TracerFunction::FlushBranches)
+    key = "TracerFlushBranches";
+  else if (tracerFunc == TracerFunction::RecordTarget)
+    key = "TracerRecordTarget";
+  else if (tracerFunc == TracerFunction::RecordCall)
+    key = "TracerRecordCall";
+  else if (tracerFunc == TracerFunction::RecordReturn)
+    key = "TracerRecordReturn";
+  else if (tracerFunc == TracerFunction::RecordPacked)
+    key = "TracerRecordPacked";
+  else if (tracerFunc == TracerFunction::ClearCounters)
+    key = "TracerClearCounters";
+  else if (tracerFunc == TracerFunction::Count)
+    key = "TracerCount";
+  else if (tracerFunc == TracerFunction::FlushCounters)
+    key = "TracerFlushCounters";
+  else if (tracerFunc == TracerFunction::FlushHistogram)
+    key = "TracerFlushHistogram";
+  else if (tracerFunc == TracerFunction::InitDetail)
+    key = "TracerInitDetail";
+  else if (tracerFunc == TracerFunction::OpenWindow)
+    key = "TracerOpenWindow";
+  else if (tracerFunc == TracerFunction::RecordDetail)
+    key = "TracerRecordDetail";
+  else if (tracerFunc == TracerFunction::FinishDetail)
+    key = "TracerFinishDetail";
+  else if (tracerFunc == TracerFunction::SetSamplePeriod)
+    key = "TracerSetSamplePeriod";
+  else if (tracerFunc == TracerFunction::Enable)
+    key = "TracerEnable";
+  else if (tracerFunc == TracerFunction::Enter)
+    key = "TracerEnter";
+  else if (tracerFunc == TracerFunction::InitChannels)
+    key = "TracerInitChannels";
+  else if (tracerFunc == TracerFunction::ChannelRecord)
+    key = "TracerChannelRecord";
+  else if (tracerFunc == TracerFunction::ChannelStamp)
+    key = "TracerChannelStamp";
+  else if (tracerFunc == TracerFunction::ChannelFinish)
+    key = "TracerChannelFinish";
+  else if (tracerFunc == TracerFunction::StreamRecord)
+    key = "TracerStreamRecord";
+  else if (tracerFunc == TracerFunction::StreamStartClock)
+    key = "TracerStreamStartClock";
+  else if (tracerFunc == TracerFunction::StreamStamp)
+    key = "TracerStreamStamp";
+  else if (tracerFunc == TracerFunction::StreamFinish)
+    key = "TracerStreamFinish";
+  else if (tracerFunc == TracerFunction::WideInit)
+    key = "TracerWideInit";
+  else if (tracerFunc == TracerFunction::WideRecord)
+    key = "TracerWideRecord";
+  else if (tracerFunc == TracerFunction::WideStartClock)
+    key = "TracerWideStartClock";
+  else if (tracerFunc == TracerFunction::WideStamp)
+    key = "TracerWideStamp";
+  else if (tracerFunc == TracerFunction::WideFinish)
+    key = "TracerWideFinish";
+  else if (tracerFunc == TracerFunction::InitSignature)
+    key = "TracerInitSignature";
+  else if (tracerFunc == TracerFunction::Fold)
+    key = "TracerFold";
+  else if (tracerFunc == TracerFunction::FinishSignature)
+    key = "TracerFinishSignature";
+  else if (tracerFunc == TracerFunction::StartClock)
+    key = "TracerStartClock";
+  else if (tracerFunc == TracerFunction::Stamp)
+    key = "TracerStamp";
   else if (tracerFunc == TracerFunction::Finish)
     key = "TracerFinish";
   else
     return nullptr;
 
-  // This checks whether the given key value is contained in the map element's
-  // key.
-  auto it = std::find_if(
-      tracerFunctions.begin(), tracerFunctions.end(),
-      [&key](const std::pair<std::string, Function*>& element) -> bool {
-        return element.first.find(key) != std::string::npos;
-      });
-
-  if (it != tracerFunctions.end()) {
-    func = it->second;
+  // Names of different tracer functions can be contained in one another (e.g.
+  // controlFlowTracerRecord and controlFlowTracerRecordTrip), so the declared
+  // name must match exactly. A templated tracer function must also be of the
+  // instantiation in use, and a plain one must not be templated.
+  for (auto& entry : tracerFunctions) {
+    auto name = splitTracerName(entry.first);
+    if (name.first != "controlFlow" + key)
+      continue;
+    StringRef args(name.second);
+    if (tracerInstantiation.empty() ? !args.startswith("I") : args.startswith(tracerInstantiation))
+      func = entry.second;
   }
   return func;
 }
@@ -4,10 +4,15 @@
 #
 # Usage:
 #   ./run.sh USER_CODE_PATH [TOP_FUNCTION_NAME]
+#
+# Set HLS_TRACER_TEMPLATED=1 to link the templated tracer, which is built for
+# the 260-entry trace arrays of testfunctions/ by default, e.g.
+#   HLS_TRACER_TEMPLATED=1 ./run.sh testfunctions/sigma.cpp
 
 export HLS_TRACER_USER_CODE="$1"
 export HLS_TRACER_USER_TB="${1%.cpp}_test.cpp"
 export HLS_TRACER_TOP_FUNCTION="${2:-top}"
+export HLS_TRACER_SITE_TABLE="${HLS_TRACER_SITE_TABLE:-$PWD/proj/control-flow-sites.json}"
 
 if [ -n "$HLS_TRACER_NO_TRACER" ]; then
   vitis_hls without_tracer.tcl
@@ -1,8 +1,8 @@
 // Working example of using sub-functions.
-// Basically, you need to add `int *trace` to the definition
-// of all sub-functions and `trace` to all call sites.
+// The pass adds the trace array as the first argument of abs and passes it at
+// the call site, so sub-functions need no `int *trace` argument.
 
-int abs(int *trace, int data) {
+int abs(int data) {
   if (data >= 0) {
     return data;
   } else {
@@ -10,10 +10,10 @@ int abs(int *trace, int data) {
   }
 }
 
-int top(int trace[258]) {
+int top(int trace[260]) {
   int acc = 0;
   for (int i=0; i<=20; i++) {
-    acc += abs(trace, i-10);
+    acc += abs(i-10);
   }
 
   return acc;
@@ -1,7 +1,7 @@
 #include <iostream>
 #include "get_result_json.h"
 
-#define ARR_SZ 258
+#define ARR_SZ 260
 
 extern int top(int trace[ARR_SZ]);
 
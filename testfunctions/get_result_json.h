@@ -2,28 +2,810 @@
 #define _GET_RESULT_JSON_H_
 
 #include "json.hpp"
+#include "../tracer/control-flow-trace-format.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
 #include <fstream>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
 #include <unistd.h>
 using json = nlohmann::json;
 
-json getResultInJson(const int *array, const int size, std::string filename) {
-  json result;
-  int current_index = array[size-2];
-  bool wrapped = array[size-1] ? true : false;
+// Load the site table written by the instrumentation pass. Its path is taken
+// from the environment variable HLS_TRACER_SITE_TABLE, just like in the pass.
+json loadSiteTable() {
+  json table = json::object();
+  const char *path = std::getenv("HLS_TRACER_SITE_TABLE");
+  if (!path)
+    path = "control-flow-sites.json";
+
+  std::ifstream i(path);
+  if (i) {
+    i >> table;
+  } else {
+    std::cout << "Site table " << path << " not found. Reporting raw site IDs." << std::endl;
+  }
+  return table;
+}
+
+// Expand a site ID into its source location using the site table.
+json decodeSite(const json &table, int site) {
+  json record = {{"site", site}};
+  if (table.contains("sites") && site >= 0 && site < (int)table["sites"].size()) {
+    const json &info = table["sites"][site];
+    for (auto key : {"file", "function", "line", "column", "block", "kind"}) {
+      record[key] = info[key];
+    }
+  }
+  return record;
+}
+
+// Expand a call site ID of a call or return record into its source location and
+// callee using the site table. kind is "call" or "return".
+json decodeCall(const json &table, const char *kind, int call) {
+  json record = {{kind, call}};
+  if (table.contains("calls") && call >= 0 && call < (int)table["calls"].size()) {
+    const json &info = table["calls"][call];
+    for (auto key : {"file", "function", "line", "column", "callee"}) {
+      record[key] = info[key];
+    }
+  }
+  return record;
+}
+
+// Turn a Ball-Larus path ID back into the basic blocks along the path, using
+// the CFG and edge values of the function it belongs to. From the virtual
+// ENTRY, repeatedly take the out edge with the largest value that does not
+// exceed what is left of the ID, until the virtual EXIT is reached.
+json decodePath(const json &table, int path) {
+  json record = {{"path", path}};
+  if (!table.contains("functions")) {
+    return record;
+  }
+  for (const json &func : table["functions"]) {
+    int base = func["path_base"];
+    if (path < base || path >= base + (int)func["path_count"]) {
+      continue;
+    }
+    record["function"] = func["name"];
+    record["blocks"] = json::array();
+    int remaining = path - base;
+    int node = -1;  // ENTRY
+    do {
+      const json *taken = nullptr;
+      for (const json &edge : func["edges"]) {
+        if (edge["from"] == node && edge["value"] <= remaining &&
+            (!taken || edge["value"] > (*taken)["value"])) {
+          taken = &edge;
+        }
+      }
+      remaining -= (int)(*taken)["value"];
+      node = (*taken)["to"];
+      if (node != -1) {
+        record["blocks"].push_back(func["blocks"][node]);
+      }
+    } while (node != -1);
+    break;
+  }
+  return record;
+}
+
+// Find the CFG of the pipelined loop entered at the given site. Returns null if
+// there is none.
+const json *findPipeline(const json &table, int site) {
+  if (table.contains("pipelines")) {
+    for (const json &pipeline : table["pipelines"]) {
+      if (pipeline["site"] == site) {
+        return &pipeline;
+      }
+    }
+  }
+  return nullptr;
+}
+
+// Find the CFG of the function entered at the given site in branches mode.
+// Returns null if there is none.
+const json *findBranchFunction(const json &table, int site) {
+  if (table.value("mode", "") == "branches" && table.contains("functions")) {
+    for (const json &func : table["functions"]) {
+      if (func["site"] == site) {
+        return &func;
+      }
+    }
+  }
+  return nullptr;
+}
+
+// Expand trace records into one JSON object per site hit or path. Loop entry
+// records get the trip count of their loop attached as "trips", and pipelined
+// loop entry records get the blocks of every iteration, replayed from the
+// branch bits, attached as "iterations". In branches mode, the records are
+// replayed over the CFGs into one JSON object per block executed. Stamped records
+// get the cycles since the clock started attached as "time", and the cycles
+// until the next stamp as "cycles".
+json decodeRecords(const json &table, const std::vector<int> &records) {
+  json result = json::array();
+  // The last record that was not a repeat record. -1 if there is none.
+  int last = -1;
+  // Index (into result) of the record stamped by the previous time record.
+  size_t stamped = (size_t)-1;
+  // The unwrapped sequence number of the last sample, and whether the next
+  // record is a sample.
+  long long sequence = 0;
+  bool sampled = false;
+  // Cycles since the clock started (if nothing before was overwritten by a
+  // wrap), and whether the next record is stamped with it.
+  long long now = 0;
+  bool timed = false;
+  // The invocation number of the last synchronization packet, whether the
+  // next record follows it, and the lower half of its clock.
+  int invocation = 0;
+  bool synced = false;
+  long long sync_clock = 0;
+  // Indices (into result) of loop entry records whose loop has not exited yet.
+  std::vector<size_t> open_loops;
+  // The pipelined loop whose branch bits are being replayed, the index (into
+  // result) of its entry record, and the block it is in.
+  const json *pipeline = nullptr;
+  size_t pipeline_entry = 0;
+  int node = -1;
+
+  // Follow the pipelined loop into the given block, and on through blocks with
+  // a single successor, until a block that takes a branch bit. Every cycle in
+  // the loop goes through the header, so more steps than blocks mean the loop
+  // cannot exit.
+  auto replay = [&](int next) {
+    json &iterations = result[pipeline_entry]["iterations"];
+    for (size_t steps = 0; next != -1 && steps <= (*pipeline)["blocks"].size(); steps++) {
+      node = next;
+      if (node == 0) {
+        iterations.push_back(json::array());
+      }
+      iterations.back().push_back((*pipeline)["blocks"][node]["block"]);
+      const json &successors = (*pipeline)["blocks"][node]["successors"];
+      if (successors.size() != 1) {
+        return;
+      }
+      next = successors[0];
+    }
+    pipeline = nullptr;
+  };
+
+  // The call stack replayed in branches mode. Each frame holds a function, the
+  // block it is in, and how many calls of that block have not been entered.
+  struct Frame {
+    const json *func;
+    int node;
+    int calls;
+  };
+  std::vector<Frame> frames;
+
+  // Enter the given block in the innermost frame.
+  auto enter = [&](int next) {
+    Frame &frame = frames.back();
+    const json &block = (*frame.func)["blocks"][next];
+    frame.node = next;
+    frame.calls = block["calls"];
+    result.push_back({{"function", (*frame.func)["name"]}, {"block", block["block"]},
+                      {"line", block["line"]}});
+  };
+
+  // Follow the blocks with a single successor, and return to the caller from
+  // blocks with none, until a callee entry, branch bit, or target record is
+  // needed. More steps than blocks in a function mean it cannot exit.
+  auto follow = [&]() {
+    size_t steps = 0;
+    while (!frames.empty()) {
+      Frame &frame = frames.back();
+      const json &block = (*frame.func)["blocks"][frame.node];
+      const json &successors = block["successors"];
+      if (frame.calls > 0 || block.value("targets", false) || successors.size() > 1) {
+        return;
+      } else if (successors.empty()) {
+        frames.pop_back();
+        steps = 0;
+      } else if (++steps > (*frame.func)["blocks"].size()) {
+        frames.clear();
+      } else {
+        enter(successors[0]);
+      }
+    }
+  };
+
+  // A branch bit or target record while the innermost frame still has calls
+  // left means those callees did not record their entry, e.g. because their
+  // region was disabled.
+  auto skipCalls = [&]() {
+    if (!frames.empty() && frames.back().calls > 0) {
+      frames.back().calls = 0;
+      follow();
+    }
+  };
+
+  auto decodeOne = [&](int record) {
+    size_t decoded = result.size();
+    int payload = CONTROL_FLOW_TRACE_RECORD_PAYLOAD(record);
+    switch (CONTROL_FLOW_TRACE_RECORD_TAG(record)) {
+      case CONTROL_FLOW_TRACE_TAG_SITE: {
+        if (const json *entered = findBranchFunction(table, payload)) {
+          // Without a caller waiting for a callee, the caller's records were
+          // overwritten by a wrap, or not recorded.
+          if (!frames.empty() && frames.back().calls > 0) {
+            frames.back().calls--;
+          } else {
+            frames.clear();
+          }
+          frames.push_back({entered, 0, 0});
+          enter(0);
+          follow();
+          break;
+        }
+        json site = decodeSite(table, payload);
+        if (site.value("kind", "") == "loop") {
+          open_loops.push_back(result.size());
+        }
+        result.push_back(site);
+        if (const json *entered = findPipeline(table, payload)) {
+          pipeline = entered;
+          pipeline_entry = result.size() - 1;
+          result[pipeline_entry]["iterations"] = json::array();
+          replay(0);
+        }
+        break;
+      }
+      case CONTROL_FLOW_TRACE_TAG_BRANCHES: {
+        // The bits of a loop or function whose entry was overwritten by a wrap
+        // cannot be replayed.
+        int bit = CONTROL_FLOW_TRACE_TAG_SHIFT - 1;
+        while (bit > 0 && !((payload >> bit) & 1)) {
+          bit--;
+        }
+        for (bit--; bit >= 0; bit--) {
+          int successor = ((payload >> bit) & 1) ? 0 : 1;
+          skipCalls();
+          if (!frames.empty()) {
+            enter((*frames.back().func)["blocks"][frames.back().node]["successors"][successor]);
+            follow();
+          } else if (pipeline) {
+            replay((*pipeline)["blocks"][node]["successors"][successor]);
+          }
+        }
+        return;
+      }
+      case CONTROL_FLOW_TRACE_TAG_TARGET:
+        skipCalls();
+        if (!frames.empty()) {
+          enter((*frames.back().func)["blocks"][frames.back().node]["successors"][payload]);
+          follow();
+        }
+        return;
+      case CONTROL_FLOW_TRACE_TAG_TRIP:
+        // The entry of the loop may have been overwritten by a wrap.
+        if (open_loops.empty()) {
+          result.push_back({{"trips", payload}});
+        } else {
+          result[open_loops.back()]["trips"] = payload;
+          open_loops.pop_back();
+        }
+        break;
+      case CONTROL_FLOW_TRACE_TAG_PATH:
+        result.push_back(decodePath(table, payload));
+        break;
+      case CONTROL_FLOW_TRACE_TAG_CALL:
+        result.push_back(decodeCall(table, "call", payload));
+        break;
+      case CONTROL_FLOW_TRACE_TAG_RETURN:
+        result.push_back(decodeCall(table, "return", payload));
+        break;
+      case CONTROL_FLOW_TRACE_TAG_TIME:
+        // The cycles before the first stamped record, or since a stamped record
+        // that was overwritten by a wrap, have no record to go to.
+        if (stamped < result.size()) {
+          result[stamped]["cycles"] = payload;
+        } else {
+          result.push_back({{"cycles", payload}});
+        }
+        stamped = result.size();
+        now += payload;
+        timed = true;
+        return;
+      case CONTROL_FLOW_TRACE_TAG_TRIGGER:
+        result.push_back({{"trigger", payload}});
+        break;
+      case CONTROL_FLOW_TRACE_TAG_SYNC: {
+        int value = payload & CONTROL_FLOW_TRACE_SYNC_VALUE_MASK;
+        switch (payload >> CONTROL_FLOW_TRACE_SYNC_FIELD_SHIFT) {
+          case CONTROL_FLOW_TRACE_SYNC_INVOCATION:
+            invocation = value;
+            synced = true;
+            break;
+          case CONTROL_FLOW_TRACE_SYNC_CLOCK_LOW:
+            sync_clock = value;
+            break;
+          case CONTROL_FLOW_TRACE_SYNC_CLOCK_HIGH:
+            // Absolute, so it also fixes the time after records lost to a wrap.
+            // The tracer only writes the clock fields if records are stamped.
+            now = ((long long)value << 16) | sync_clock;
+            break;
+        }
+        return;
+      }
+      case CONTROL_FLOW_TRACE_TAG_SEQUENCE:
+        // Sequence numbers wrap around at 2^28, but always increase in between.
+        sequence += (payload - sequence) & CONTROL_FLOW_TRACE_PAYLOAD_MASK;
+        sampled = true;
+        return;
+      default:
+        std::cout << "Skipping record with unknown tag: " << record << std::endl;
+    }
+    // Attach the sequence number and the time to the record they precede.
+    if (result.size() > decoded) {
+      if (sampled) {
+        result[decoded]["sequence"] = sequence;
+        sampled = false;
+      }
+      if (timed) {
+        result[decoded]["time"] = now;
+        timed = false;
+      }
+      if (synced) {
+        result[decoded]["invocation"] = invocation;
+        synced = false;
+      }
+    }
+  };
+
+  for (int record : records) {
+    if (CONTROL_FLOW_TRACE_RECORD_TAG(record) == CONTROL_FLOW_TRACE_TAG_REPEAT) {
+      // A repeat whose record was overwritten by a wrap cannot be expanded.
+      if (last != -1) {
+        for (int i = 0; i < CONTROL_FLOW_TRACE_RECORD_PAYLOAD(record); i++) {
+          decodeOne(last);
+        }
+      }
+    } else {
+      decodeOne(record);
+      last = record;
+    }
+  }
+  return result;
+}
+
+// Drop the records before the first synchronization packet. The oldest records
+// of a wrapped trace may depend on records that were overwritten, e.g. repeat,
+// time, trip, and branches records, so decoding starts at a known state. If
+// there is no packet, all records are kept.
+std::vector<int> resynchronize(const std::vector<int> &records) {
+  for (size_t i = 0; i < records.size(); i++) {
+    int payload = CONTROL_FLOW_TRACE_RECORD_PAYLOAD(records[i]);
+    if (CONTROL_FLOW_TRACE_RECORD_TAG(records[i]) == CONTROL_FLOW_TRACE_TAG_SYNC &&
+        (payload >> CONTROL_FLOW_TRACE_SYNC_FIELD_SHIFT) == CONTROL_FLOW_TRACE_SYNC_INVOCATION) {
+      if (i != 0) {
+        std::cout << "Skipping " << i << " records before the first synchronization packet." << std::endl;
+      }
+      return std::vector<int>(records.begin() + i, records.end());
+    }
+  }
+  return records;
+}
 
-  std::cout << "Recorded trace #: " << (wrapped ? (size - 2) / 2 : (current_index + 1) / 2) << std::endl;
+// Unpack words of site records packed at the width given by "site_bits" in the
+// site table, the first in the lowest bits, into one site record each. The
+// all-ones ID pads the last word.
+std::vector<int> unpackSites(const json &table, const std::vector<int> &words) {
+  int bits = table["site_bits"];
+  unsigned padding = (1u << bits) - 1;
+  std::vector<int> records;
+  for (int word : words) {
+    for (int shift = 0; shift + bits <= 32; shift += bits) {
+      unsigned site = ((unsigned)word >> shift) & padding;
+      if (site != padding) {
+        records.push_back(CONTROL_FLOW_TRACE_RECORD(CONTROL_FLOW_TRACE_TAG_SITE, site));
+      }
+    }
+  }
+  return records;
+}
+
+// Turn the site histogram written with -controlflowtrace-histogram into the
+// sites with their hit counts, most frequent first.
+json decodeHistogram(const json &table, const int *counts) {
+  json result = json::array();
+  for (int site = 0; site < (int)table["sites"].size(); site++) {
+    json entry = decodeSite(table, site);
+    entry["count"] = (unsigned)counts[site];
+    result.push_back(entry);
+  }
+  std::stable_sort(result.begin(), result.end(), [](const json &a, const json &b) {
+    return (unsigned)a["count"] > (unsigned)b["count"];
+  });
+  return result;
+}
+
+// Derive the execution counts of all edges and blocks from the edge counters
+// written in edges mode. Counted edges come straight from the counters. The
+// remaining edges form a spanning tree, so there is always a node with only
+// one unknown edge left, whose count follows from flow conservation.
+json decodeCounters(const json &table, const std::vector<int> &counters) {
+  json result = json::array();
+  if (!table.contains("functions")) {
+    return result;
+  }
+  for (const json &func : table["functions"]) {
+    const json &edges = func["edges"];
+    std::vector<long long> counts(edges.size(), 0);
+    std::vector<bool> known(edges.size(), false);
+    size_t num_known = 0;
+    for (size_t e = 0; e < edges.size(); e++) {
+      int counter = edges[e]["counter"];
+      if (counter >= 0) {
+        counts[e] = counter < (int)counters.size() ? counters[counter] : 0;
+        known[e] = true;
+        num_known++;
+      }
+    }
+
+    // Node -1 is the virtual node that both ENTRY and EXIT map to.
+    int num_blocks = func["blocks"].size();
+    bool progress = true;
+    while (num_known < edges.size() && progress) {
+      progress = false;
+      for (int node = -1; node < num_blocks; node++) {
+        long long flow = 0;  // Inflow minus outflow of the known edges
+        int unknown = -1, num_unknown = 0;
+        for (size_t e = 0; e < edges.size(); e++) {
+          int sign = (edges[e]["to"] == node) - (edges[e]["from"] == node);
+          if (!sign) {
+            continue;
+          } else if (known[e]) {
+            flow += sign * counts[e];
+          } else {
+            unknown = e;
+            num_unknown++;
+          }
+        }
+        if (num_unknown == 1) {
+          int sign = edges[unknown]["to"] == node ? 1 : -1;
+          counts[unknown] = -sign * flow;
+          known[unknown] = true;
+          num_known++;
+          progress = true;
+        }
+      }
+    }
+
+    json record = {{"function", func["name"]}, {"blocks", json::array()}, {"edges", json::array()}};
+    std::vector<long long> block_counts(num_blocks, 0);
+    for (size_t e = 0; e < edges.size(); e++) {
+      int from = edges[e]["from"], to = edges[e]["to"];
+      if (to != -1) {
+        block_counts[to] += counts[e];
+      }
+      record["edges"].push_back({{"from", from == -1 ? json("ENTRY") : func["blocks"][from]["block"]},
+                                 {"to", to == -1 ? json("EXIT") : func["blocks"][to]["block"]},
+                                 {"count", counts[e]}});
+    }
+    for (int b = 0; b < num_blocks; b++) {
+      json block = func["blocks"][b];
+      block["count"] = block_counts[b];
+      record["blocks"].push_back(block);
+    }
+    result.push_back(record);
+  }
+  return result;
+}
+
+// Sum up the cycles of stamped records per site and per function. Returns null
+// if the trace has no cycle stamps.
+json summarizeCycles(const json &records) {
+  std::map<int, json> sites;
+  std::map<std::string, long long> functions;
+  bool stamped = false;
+  for (const json &record : records) {
+    if (!record.contains("cycles")) {
+      continue;
+    }
+    stamped = true;
+    long long cycles = record["cycles"];
+    if (record.contains("site")) {
+      json &site = sites[record["site"]];
+      if (site.is_null()) {
+        site = record;
+        site.erase("cycles");
+        site.erase("trips");
+        site["hits"] = 0;
+        site["cycles"] = 0;
+      }
+      site["hits"] = (long long)site["hits"] + 1;
+      site["cycles"] = (long long)site["cycles"] + cycles;
+    }
+    if (record.contains("function")) {
+      functions[record["function"]] += cycles;
+    }
+  }
+  if (!stamped) {
+    return json();
+  }
+
+  json summary = {{"sites", json::array()}, {"functions", json::array()}};
+  for (auto &site : sites) {
+    summary["sites"].push_back(site.second);
+  }
+  for (auto &func : functions) {
+    summary["functions"].push_back({{"function", func.first}, {"cycles", func.second}});
+  }
+  return summary;
+}
+
+// Estimate how many times each site and path was reached from a sampled trace.
+// The mean distance between the sequence numbers of consecutive samples is the
+// effective sample period, and each sample stands for that many events.
+// Returns null if the trace is not sampled.
+json estimateSampledCounts(const json &records) {
+  std::map<std::string, json> estimates;
+  long long first = 0, last = 0, samples = 0;
+  for (const json &record : records) {
+    if (!record.contains("sequence")) {
+      continue;
+    }
+    last = record["sequence"];
+    if (samples++ == 0) {
+      first = last;
+    }
+    std::string key = record.contains("site") ? "site" : "path";
+    if (!record.contains(key)) {
+      continue;
+    }
+    json &estimate = estimates[key + std::to_string((int)record[key])];
+    if (estimate.is_null()) {
+      estimate = record;
+      estimate.erase("sequence");
+      estimate["samples"] = 0;
+    }
+    estimate["samples"] = (long long)estimate["samples"] + 1;
+  }
+  if (samples == 0) {
+    return json();
+  }
 
+  double period = samples > 1 ? (double)(last - first) / (samples - 1) : 0;
+  json summary = {{"samples", samples}, {"events", last}, {"period", period}, {"counts", json::array()}};
+  for (auto &estimate : estimates) {
+    estimate.second["count"] = (long long)estimate.second["samples"] * period;
+    summary["counts"].push_back(estimate.second);
+  }
+  return summary;
+}
+
+// Collect the records of a slice that marks its end with an end record, from
+// the oldest to the newest. Returns false if there is no end record. Sets
+// wrapped if the slice wrapped.
+bool readSlice(const int *begin, int slice, std::vector<int> &records, bool &wrapped) {
+  const int *end = begin + slice;
+  const int *marker = begin;
+  while (marker != end && CONTROL_FLOW_TRACE_RECORD_TAG(*marker) != CONTROL_FLOW_TRACE_TAG_END) {
+    marker++;
+  }
+  if (marker == end) {
+    return false;
+  }
+  wrapped = CONTROL_FLOW_TRACE_RECORD_PAYLOAD(*marker) != 0;
   if (wrapped) {
-    for (int i = current_index; i < size-2; i+=2) {
-      result.push_back({{"line", array[i]}, {"column", array[i+1]}});
+    records.insert(records.end(), marker + 1, end);
+  }
+  records.insert(records.end(), begin, marker);
+  return true;
+}
+
+// Replace the records between the two window records of every detail window
+// with the records of the window in the detail slice, which repeat them with
+// the detail records in between. Detail records before the first window record
+// belong to a window that was partly overwritten by a wrap, and are dropped. A
+// window whose detail records or closing window record are missing keeps its
+// records.
+std::vector<int> stitchWindows(const std::vector<int> &records, const std::vector<int> &detail) {
+  std::map<int, std::vector<int>> windows;
+  std::vector<int> *window = nullptr;
+  for (int record : detail) {
+    if (CONTROL_FLOW_TRACE_RECORD_TAG(record) == CONTROL_FLOW_TRACE_TAG_WINDOW) {
+      window = &windows[CONTROL_FLOW_TRACE_RECORD_PAYLOAD(record)];
+      window->clear();
+    } else if (window) {
+      window->push_back(record);
     }
   }
 
-  for (int i = 0; i < current_index; i+=2) {
-    result.push_back({{"line", array[i]}, {"column", array[i+1]}});
+  std::vector<int> result;
+  size_t stitched = 0;
+  for (size_t i = 0; i < records.size(); i++) {
+    if (CONTROL_FLOW_TRACE_RECORD_TAG(records[i]) != CONTROL_FLOW_TRACE_TAG_WINDOW) {
+      result.push_back(records[i]);
+      continue;
+    }
+    auto found = windows.find(CONTROL_FLOW_TRACE_RECORD_PAYLOAD(records[i]));
+    if (found == windows.end()) {
+      continue;
+    }
+    auto close = std::find(records.begin() + i + 1, records.end(), records[i]);
+    if (close == records.end()) {
+      continue;
+    }
+    result.insert(result.end(), found->second.begin(), found->second.end());
+    i = close - records.begin();
+    stitched++;
+  }
+  std::cout << "Stitched " << stitched << " of " << windows.size() << " detail windows into the trace." << std::endl;
+  return result;
+}
+
+// Decode the slices of the dataflow processes and merge their records with the
+// decoded records outside of them. Records are tagged with their "process".
+// If cycle stamps are present and no slice wrapped, the records are merged in
+// the order of their times. Otherwise, the processes are appended one after
+// another, each in its own order.
+json mergeProcessRecords(const json &table, const int *array, int slice, bool wrapped,
+                         const json &outside, size_t &num_records) {
+  std::vector<json> channels = {outside};
+  bool any_wrapped = wrapped;
+  for (size_t c = 1; c <= table["processes"].size(); c++) {
+    std::vector<int> records;
+    bool channel_wrapped = false;
+    if (!readSlice(array + c * slice, slice, records, channel_wrapped)) {
+      std::cout << "No end record for process " << table["processes"][c - 1] << ". Skipping." << std::endl;
+      continue;
+    }
+    any_wrapped |= channel_wrapped;
+    num_records += records.size();
+
+    json decoded = decodeRecords(table, records);
+    for (json &record : decoded) {
+      record["process"] = table["processes"][c - 1];
+    }
+    channels.push_back(decoded);
   }
 
+  // Order by the time of the latest stamp at or before each record.
+  std::vector<std::pair<long long, json>> merged;
+  bool timed = false;
+  for (const json &channel : channels) {
+    long long time = 0;
+    for (const json &record : channel) {
+      if (record.contains("time")) {
+        time = record["time"];
+        timed = true;
+      }
+      merged.push_back({time, record});
+    }
+  }
+  if (timed && !any_wrapped) {
+    std::stable_sort(merged.begin(), merged.end(),
+                     [](const std::pair<long long, json> &a, const std::pair<long long, json> &b) {
+                       return a.first < b.first;
+                     });
+  }
+
+  json result = json::array();
+  for (auto &entry : merged) {
+    result.push_back(entry.second);
+  }
+  return result;
+}
+
+// Build the calling-context tree of decoded records with call and return
+// records. Every node is a chain of call sites from the root, and counts how
+// many times it was called, and its site and path records by ID. The root is
+// the context of the oldest record, which is not the top-level function if the
+// trace wrapped. A return without a matching call on the stack, e.g. because
+// the call was overwritten, is ignored. Returns null if there are no calls.
+json buildCallingContextTree(const json &records) {
+  struct Node {
+    json call;
+    long long calls;
+    std::map<int, long long> sites;
+    std::map<int, long long> paths;
+    std::map<int, size_t> children;
+  };
+  std::vector<Node> nodes(1);
+  nodes[0].calls = 0;
+  std::vector<size_t> stack = {0};
+  bool has_calls = false;
+  for (const json &record : records) {
+    if (record.contains("call")) {
+      has_calls = true;
+      int call = record["call"];
+      auto child = nodes[stack.back()].children.find(call);
+      if (child == nodes[stack.back()].children.end()) {
+        json info = record;
+        nodes.push_back({info, 0, {}, {}, {}});
+        child = nodes[stack.back()].children.insert({call, nodes.size() - 1}).first;
+      }
+      stack.push_back(child->second);
+      nodes[stack.back()].calls++;
+    } else if (record.contains("return")) {
+      // Pop up to the matching call, skipping calls whose return was lost.
+      for (size_t depth = stack.size() - 1; depth > 0; depth--) {
+        if (nodes[stack[depth]].call["call"] == record["return"]) {
+          stack.resize(depth);
+          break;
+        }
+      }
+    } else if (record.contains("site")) {
+      nodes[stack.back()].sites[record["site"]]++;
+    } else if (record.contains("path")) {
+      nodes[stack.back()].paths[record["path"]]++;
+    }
+  }
+  if (!has_calls) {
+    return nullptr;
+  }
+
+  std::function<json(size_t)> toJson = [&](size_t index) {
+    const Node &node = nodes[index];
+    json result = node.call.is_null() ? json::object() : node.call;
+    if (index != 0) {
+      result["calls"] = node.calls;
+    }
+    for (auto &site : node.sites) {
+      result["sites"][std::to_string(site.first)] = site.second;
+    }
+    for (auto &path : node.paths) {
+      result["paths"][std::to_string(path.first)] = path.second;
+    }
+    result["children"] = json::array();
+    for (auto &child : node.children) {
+      result["children"].push_back(toJson(child.second));
+    }
+    return result;
+  };
+  return toJson(0);
+}
+
+// Write the cycle summary, the sampled count estimates, and the calling-context
+// tree of decoded records next to the trace, if there are any.
+void saveSummariesInJson(const json &result, const std::string &filename) {
+  // Write the cycle summary next to the trace, e.g. trace.cycles.json.
+  json summary = summarizeCycles(result);
+  if (!summary.is_null()) {
+    std::string summary_filename = filename.substr(0, filename.rfind('.')) + ".cycles.json";
+    std::cout << "Saving cycle summary as json to " << summary_filename << std::endl;
+    std::ofstream o(summary_filename);
+    o << std::setw(4) << summary << std::endl;
+  }
+
+  // Write the scaled-up counts of a sampled trace, e.g. trace.samples.json.
+  json estimates = estimateSampledCounts(result);
+  if (!estimates.is_null()) {
+    std::string estimates_filename = filename.substr(0, filename.rfind('.')) + ".samples.json";
+    std::cout << "Saving sampled count estimates as json to " << estimates_filename << std::endl;
+    std::ofstream o(estimates_filename);
+    o << std::setw(4) << estimates << std::endl;
+  }
+
+  // Write the calling-context tree, e.g. trace.contexts.json.
+  json contexts = buildCallingContextTree(result);
+  if (!contexts.is_null()) {
+    std::string contexts_filename = filename.substr(0, filename.rfind('.')) + ".contexts.json";
+    std::cout << "Saving calling-context tree as json to " << contexts_filename << std::endl;
+    std::ofstream o(contexts_filename);
+    o << std::setw(4) << contexts << std::endl;
+  }
+}
+
+// Report how much of the run the trace covers, from the number of words the
+// tracer generated and the number of them still in the trace.
+void reportCoverage(long long kept, unsigned long long generated, unsigned wraps) {
+  if (generated == 0) {
+    return;
+  }
+  std::cout << "Kept " << kept << " of " << generated << " generated words ("
+            << 100.0 * kept / generated << "% coverage), wrapped " << wraps << " times." << std::endl;
+}
+
+void saveResultInJson(const json &result, const std::string &filename) {
   // Write json result to file
   char tmp[256];
   getcwd(tmp, 256);
@@ -31,8 +813,157 @@ json getResultInJson(const int *array, const int size, std::string filename) {
 
   std::ofstream o(filename);
   o << std::setw(4) << result << std::endl;
+}
+
+json getResultInJson(const int *array, const int size, std::string filename) {
+  json table = loadSiteTable();
+  int current_index = array[size-4];
+  unsigned wraps = array[size-3];
+  bool wrapped = wraps ? true : false;
+  unsigned long long generated = (unsigned)array[size-2] | (unsigned long long)(unsigned)array[size-1] << 32;
+
+  json result;
+  if (table.value("mode", "") == "edges") {
+    // The counters are at the start of the array and never wrap.
+    std::vector<int> counters(array, array + current_index);
+    result = decodeCounters(table, counters);
+    std::cout << "Recorded counter #: " << counters.size() << " (" << result.size() << " functions after decoding)" << std::endl;
+  } else {
+    // With dataflow processes, the records outside of them are in the first
+    // slice, and the rest of the slices belong to the processes.
+    int slice = table.value("channel_slice", size - 4);
+
+    // Collect records from the oldest to the newest.
+    std::vector<int> records;
+    if (wrapped) {
+      records.insert(records.end(), array + current_index, array + slice);
+    }
+    records.insert(records.end(), array, array + current_index);
+    if (table.contains("site_bits")) {
+      records = unpackSites(table, records);
+    } else if (wrapped) {
+      records = resynchronize(records);
+    }
+
+    // The detail slice follows the first one.
+    if (table.contains("detail_slice")) {
+      std::vector<int> detail;
+      bool detail_wrapped = false;
+      if (readSlice(array + slice, slice, detail, detail_wrapped)) {
+        records = stitchWindows(records, detail);
+      } else {
+        std::cout << "No end record for the detail slice. Skipping." << std::endl;
+      }
+    }
+
+    result = decodeRecords(table, records);
+    size_t num_records = records.size();
+    if (table.contains("processes")) {
+      result = mergeProcessRecords(table, array, slice, wrapped, result, num_records);
+    }
+    std::cout << "Recorded trace #: " << num_records << " (" << result.size() << " after decoding)" << std::endl;
+    reportCoverage(wrapped ? slice : current_index, generated, wraps);
+    saveSummariesInJson(result, filename);
+
+    // Write the site histogram next to the trace, e.g. trace.histogram.json.
+    if (table.contains("histogram_offset")) {
+      json histogram = decodeHistogram(table, array + (int)table["histogram_offset"]);
+      std::string histogram_filename = filename.substr(0, filename.rfind('.')) + ".histogram.json";
+      std::cout << "Saving site histogram as json to " << histogram_filename << std::endl;
+      std::ofstream o(histogram_filename);
+      o << std::setw(4) << histogram << std::endl;
+    }
+  }
+
+  saveResultInJson(result, filename);
+  return result;
+}
+
+// Count the invocations of a top-level function traced with
+// -controlflowtrace-signature by the path they took. Each invocation leaves the
+// signature of its path and the number of records folded into it in the first
+// two entries of its trace array. Buckets are keyed by the signature in hex. A
+// bucket whose invocations folded different numbers of records holds a
+// collision, and is reported.
+void addSignature(json &buckets, const int *array) {
+  char key[16];
+  snprintf(key, sizeof(key), "0x%08x", (unsigned)array[0]);
+  unsigned records = array[1];
+  if (!buckets.contains(key)) {
+    buckets[key] = {{"records", records}, {"invocations", 0}};
+  } else if (buckets[key]["records"] != records) {
+    std::cout << "Signature " << key << " was folded from " << buckets[key]["records"]
+              << " and " << records << " records. The paths collide." << std::endl;
+  }
+  buckets[key]["invocations"] = (int)buckets[key]["invocations"] + 1;
+}
+
+// Drain the trace of a top-level function whose first argument is an
+// hls::stream<int>, up to and including the end record, and decode it just
+// like getResultInJson. The stream type is a template parameter so that this
+// header does not depend on hls_stream.h.
+template <typename Stream>
+json getStreamResultInJson(Stream &stream, std::string filename) {
+  json table = loadSiteTable();
+  std::vector<int> records;
+  while (!stream.empty()) {
+    int record = stream.read();
+    if (CONTROL_FLOW_TRACE_RECORD_TAG(record) == CONTROL_FLOW_TRACE_TAG_END) {
+      break;
+    }
+    records.push_back(record);
+  }
+
+  json result = decodeRecords(table, records);
+  std::cout << "Recorded trace #: " << records.size() << " (" << result.size() << " after decoding)" << std::endl;
+  saveSummariesInJson(result, filename);
+  saveResultInJson(result, filename);
+  return result;
+}
+
+// Unpack and decode the trace of a top-level function whose first argument is
+// an array of wide words, e.g. ap_uint<512>, just like getResultInJson. size
+// is in words. The word type is a template parameter so that this header does
+// not depend on ap_int.h.
+template <typename Word>
+json getWideResultInJson(const Word *array, const int size, std::string filename) {
+  json table = loadSiteTable();
+  const int per_word = Word::width / 32;
+  const Word &tail = array[size-1];
+  int current_index = tail.range(31, 0).to_uint();
+  unsigned wraps = tail.range(63, 32).to_uint();
+  bool wrapped = wraps ? true : false;
+  int filled = tail.range(95, 64).to_uint();
+  unsigned long long generated = 0;
+  if (Word::width >= 160) {
+    generated = tail.range(127, 96).to_uint() | (unsigned long long)tail.range(159, 128).to_uint() << 32;
+  }
+
+  // Collect records from the oldest to the newest. The partial word at the
+  // current index holds the newest ones. Without one, the word at the current
+  // index is still the oldest full word of a wrapped trace.
+  std::vector<int> records;
+  auto unpack = [&](int index, int count) {
+    for (int i = 0; i < count; i++) {
+      records.push_back(array[index].range(32 * i + 31, 32 * i).to_uint());
+    }
+  };
+  if (wrapped) {
+    for (int index = filled ? current_index + 1 : current_index; index < size - 1; index++) {
+      unpack(index, per_word);
+    }
+  }
+  for (int index = 0; index < current_index; index++) {
+    unpack(index, per_word);
+  }
+  unpack(current_index, filled);
 
+  json result = decodeRecords(table, records);
+  std::cout << "Recorded trace #: " << records.size() << " (" << result.size() << " after decoding)" << std::endl;
+  reportCoverage(records.size(), generated, wraps);
+  saveSummariesInJson(result, filename);
+  saveResultInJson(result, filename);
   return result;
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,21 @@
+// Working example of hierarchical tracing. Run it with
+//   HLS_TRACER_PASS_FLAGS="-controlflowtrace-hierarchical" ./run.sh testfunctions/hierarchy.cpp
+// In blocks mode, the only coarse records are the entries and returns of top
+// and abs, so the detail windows open at those.
+
+int abs(int data) {
+  if (data >= 0) {
+    return data;
+  } else {
+    return -data;
+  }
+}
+
+int top(int trace[260]) {
+  int acc = 0;
+  for (int i=0; i<=20; i++) {
+    acc += abs(i-10);
+  }
+
+  return acc;
+}
@@ -0,0 +1,42 @@
+#include <iostream>
+#include "get_result_json.h"
+
+#define ARR_SZ 260
+
+extern int top(int trace[ARR_SZ]);
+
+void run_test(int ans, int *trace) {
+  printf("%s\n", "Running hierarchy(trace)...");
+  int out = top(trace);
+  printf("%s\n", "Function successfully returned. Content of trace array:");
+  for (int i = 0; i < ARR_SZ; i++)
+    printf("%c%d%c", " ["[i==0], trace[i], ",]"[i==ARR_SZ-1]);
+  printf("\n");
+  if (out != ans) {
+    printf("Expected hierarchy(trace) to be %d but got %d.\n", ans, out);
+  }
+
+  json output = getResultInJson(trace, ARR_SZ, "trace.json");
+
+  // The basic block records only come back from the detail windows.
+  int coarse = 0, detail = 0;
+  for (auto &record : output) {
+    if (record.value("kind", "") == "block") {
+      detail++;
+    } else if (record.value("kind", "") == "function") {
+      coarse++;
+    }
+  }
+  printf("Decoded %d function boundary and %d basic block record(s).\n", coarse, detail);
+  if (coarse == 0 || detail == 0) {
+    printf("Expected both function boundary and basic block records.\n");
+  }
+
+  std::cout << output.dump() << std::endl;
+}
+
+int main() {
+  printf("Entered main.\n");
+  int trace[ARR_SZ] = {0};
+  run_test(110, trace);
+}
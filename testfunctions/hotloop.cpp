@@ -1,4 +1,4 @@
-int top(int trace[258], int in[128], int out[128], int data) {
+int top(int trace[260], int in[128], int out[128], int data) {
 #pragma HLS interface bram port=in
 #pragma HLS interface bram port=out
 
@@ -2,7 +2,7 @@
 #include <cstring>
 #include "get_result_json.h"
 
-#define ARR_SZ 258
+#define ARR_SZ 260
 
 extern int top(int arr[ARR_SZ], int data_in[128], int data_out[128], int n);
 
@@ -1,4 +1,4 @@
-int top(int trace[258]) {
+int top(int trace[260]) {
   int acc[16] = {0,};
   for (int i = 0; i < 5; i++) {
 #pragma HLS pipeline off
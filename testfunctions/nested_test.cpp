@@ -2,7 +2,7 @@
 #include <cstring>
 #include "get_result_json.h"
 
-#define ARR_SZ 258
+#define ARR_SZ 260
 
 extern int top(int a[ARR_SZ]);
 
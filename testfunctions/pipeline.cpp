@@ -0,0 +1,17 @@
+int top(int trace[260], int in[1024], int threshold) {
+#pragma HLS INTERFACE m_axi port=trace
+#pragma HLS interface bram port=in
+
+  int sum = 0;
+  // A site record per iteration would break II=1, so the tracer records the
+  // branch below as one bit per iteration.
+PIPELINED_LOOP: for (int i = 0; i < 1024; i++) {
+#pragma HLS pipeline II=1
+    if (in[i] > threshold)
+      sum += in[i];
+    else
+      sum -= 1;
+  }
+
+  return sum;
+}
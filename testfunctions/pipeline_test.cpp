@@ -0,0 +1,28 @@
+#include <iostream>
+#include "get_result_json.h"
+
+#define ARR_SZ 260
+
+extern int top(int arr[ARR_SZ], int in[1024], int threshold);
+
+int main() {
+  printf("Entered main.\n");
+  int trace[ARR_SZ] = {0};
+  int in[1024];
+  int ans = 0;
+  for (int i = 0; i < 1024; i++) {
+    in[i] = (i * 37) % 100;
+    ans += in[i] > 50 ? in[i] : -1;
+  }
+
+  // 1024 iterations fit in far fewer than 256 records, one bit per branch.
+  int out = top(trace, in, 50);
+  if (out != ans) {
+    printf("Expected top(trace, in, 50) to be %d but got %d.\n", ans, out);
+  }
+
+  json output = getResultInJson(trace, ARR_SZ, "trace.json");
+  std::cout << output.dump() << std::endl;
+
+  return 0;
+}
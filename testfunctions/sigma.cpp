@@ -1,4 +1,4 @@
-int top(int trace[258], int n) {
+int top(int trace[260], int n) {
 #pragma HLS INTERFACE m_axi port=trace
   
   // if (n > 128) {
@@ -0,0 +1,18 @@
+// Working example of path signatures. The trace array only holds the signature
+// and the record count, so it needs the signature option of the pass:
+//   HLS_TRACER_PASS_FLAGS="-controlflowtrace-signature" ./run.sh testfunctions/signature.cpp
+
+int top(int trace[2], int in[16], int n) {
+#pragma HLS INTERFACE m_axi port=trace
+
+  int sum = 0;
+  for (int i = 0; i < n; i++) {
+    if (in[i] % 2 == 0) {
+      sum += in[i];
+    } else {
+      sum -= in[i];
+    }
+  }
+
+  return sum;
+}
@@ -0,0 +1,36 @@
+#include <iostream>
+#include "get_result_json.h"
+
+// The signature and the number of records folded into it.
+#define ARR_SZ 2
+
+extern int top(int trace[ARR_SZ], int in[16], int n);
+
+int main() {
+  printf("Entered main.\n");
+  int trace[ARR_SZ] = {0};
+  json buckets;
+
+  // Every input of four numbers takes one of 16 paths through the loop,
+  // depending on which of the numbers are even.
+  int in[16];
+  for (int input = 0; input < 256; input++) {
+    int ans = 0;
+    for (int i = 0; i < 4; i++) {
+      in[i] = (input >> (2 * i)) & 3;
+      ans += in[i] % 2 == 0 ? in[i] : -in[i];
+    }
+
+    int out = top(trace, in, 4);
+    if (out != ans) {
+      printf("Expected top(trace, in, 4) to be %d but got %d.\n", ans, out);
+    }
+    addSignature(buckets, trace);
+  }
+
+  std::cout << "Invocations took " << buckets.size() << " distinct path(s)." << std::endl;
+  saveResultInJson(buckets, "signatures.json");
+  std::cout << buckets.dump() << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,16 @@
+#include "hls_stream.h"
+
+int top(hls::stream<int> &trace, int in[128], int n) {
+#pragma HLS INTERFACE axis port=trace
+
+  int sum = 0;
+  for (int i = 0; i < n; i++) {
+    if (in[i] % 2 == 0) {
+      sum += in[i];
+    } else {
+      sum -= in[i];
+    }
+  }
+
+  return sum;
+}
@@ -0,0 +1,27 @@
+#include <iostream>
+#include "hls_stream.h"
+#include "get_result_json.h"
+
+extern int top(hls::stream<int> &trace, int in[128], int n);
+
+int main() {
+  printf("Entered main.\n");
+  hls::stream<int> trace;
+  int in[128];
+  int ans = 0;
+  for (int i = 0; i < 128; i++) {
+    in[i] = i;
+    ans += i % 2 == 0 ? i : -i;
+  }
+
+  // Unlike a trace array, the stream has no limit on the length of the trace.
+  int out = top(trace, in, 128);
+  if (out != ans) {
+    printf("Expected top(trace, in, 128) to be %d but got %d.\n", ans, out);
+  }
+
+  json output = getStreamResultInJson(trace, "trace.json");
+  std::cout << output.dump() << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,16 @@
+#include "ap_int.h"
+
+int top(ap_uint<512> trace[17], int in[128], int n) {
+#pragma HLS INTERFACE m_axi port=trace
+
+  int sum = 0;
+  for (int i = 0; i < n; i++) {
+    if (in[i] % 2 == 0) {
+      sum += in[i];
+    } else {
+      sum -= in[i];
+    }
+  }
+
+  return sum;
+}
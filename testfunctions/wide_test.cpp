@@ -0,0 +1,29 @@
+#include <iostream>
+#include "ap_int.h"
+#include "get_result_json.h"
+
+// 16 words of 16 records each, and the tail.
+#define ARR_SZ 17
+
+extern int top(ap_uint<512> trace[ARR_SZ], int in[128], int n);
+
+int main() {
+  printf("Entered main.\n");
+  ap_uint<512> trace[ARR_SZ] = {};
+  int in[128];
+  int ans = 0;
+  for (int i = 0; i < 128; i++) {
+    in[i] = i;
+    ans += i % 2 == 0 ? i : -i;
+  }
+
+  int out = top(trace, in, 128);
+  if (out != ans) {
+    printf("Expected top(trace, in, 128) to be %d but got %d.\n", ans, out);
+  }
+
+  json output = getWideResultInJson(trace, ARR_SZ, "trace.json");
+  std::cout << output.dump() << std::endl;
+
+  return 0;
+}
@@ -38,6 +38,10 @@ HOT_LOOP_PASS_RESULT_PASS = "loop-analysis.txt"
 TEMPLATE_TCL_PATH = "run_unroll.tcl.template"
 
 VITIS_TRACE_FILE_PATHS = "{solution_dir}/sim/wrapc_pc/trace-*.json"
+# Written next to a trace file when the pass ran with -controlflowtrace-histogram.
+HISTOGRAM_SUFFIX = ".histogram.json"
+# Summaries that the testbench writes next to each trace, e.g. trace-1.cycles.json.
+SUMMARY_SUFFIXES = (".cycles.json", ".samples.json", ".contexts.json", HISTOGRAM_SUFFIX)
 VITIS_LATENCY_RRT_PATH = "proj{factor}/solution/sim/report/verilog/lat.rpt"
 VITIS_SOLUTION_DATA_JSON_PATH = "proj{factor}/solution/solution_data.json"
 
@@ -70,7 +74,9 @@ class Loop:
         name (str): The name of the loop (llvm.loop.name).
                     Either specified by the user in the source code or assigned by Vitis.
         line_range (tuple[int, int]): The loop's minimum and maximum line numbers.
-        occurrence (int): The number of times a loop was executed.
+        occurrence (int): The number of traces a loop was executed in, or the
+                          number of times its sites were hit when there are
+                          site histograms.
     """
 
     name: str
@@ -88,6 +94,13 @@ class Loop:
         minl, maxl = self.line_range
         return any(minl <= line_number <= maxl for line_number in trace)
 
+    def hits_in(self, histogram: list[dict[str, int]]) -> int:
+        """Count how many times the sites of this loop were hit."""
+        minl, maxl = self.line_range
+        return sum(
+            site["count"] for site in histogram if minl <= int(site["line"]) <= maxl
+        )
+
     def compute_temperature(self) -> int:
         """The loop with the highest temperature is the hottest one."""
         temperature = self.occurrence
@@ -122,6 +135,8 @@ def identify_hotloop(solution_dir: str) -> Loop:
     1. Parse `loop-analysis.txt` and construct a list of `Loop` objects.
     2. Find all trace JSON files inside the `solution_dir` with glob.
     3. Increment the occurrence of a loop by one every time it appears in a trace file.
+       If the trace has a site histogram, add the hits of the loop instead, which
+       are exact even if the trace wrapped.
     4. Find the loop with the highest temperature. Take draws into account.
     """
     # Create Loop objects.
@@ -135,16 +150,27 @@ def identify_hotloop(solution_dir: str) -> Loop:
     print(f"Candidate loops found: {loops}")
 
     # Count the occurrence of each loop for each trace file.
-    trace_files: list[str] = glob.glob(
-        VITIS_TRACE_FILE_PATHS.format(solution_dir=solution_dir)
-    )
+    # Skip the summaries written next to the traces. Trace names may contain
+    # dots themselves, e.g. trace-5-0.100000.json.
+    trace_files: list[str] = [
+        path
+        for path in glob.glob(VITIS_TRACE_FILE_PATHS.format(solution_dir=solution_dir))
+        if not path.endswith(SUMMARY_SUFFIXES)
+    ]
     if not trace_files:
         print("No trace files were found in the solution directory. Aborting.")
         sys.exit(1)
     for trace_file in trace_files:
+        histogram_file = trace_file[: -len(".json")] + HISTOGRAM_SUFFIX
+        if os.path.exists(histogram_file):
+            histogram: list[dict[str, int]] = json.load(open(histogram_file))
+            for loop in loops:
+                loop.occurrence += loop.hits_in(histogram)
+            continue
         full_trace: list[dict[str, int]] = json.load(open(trace_file))
-        # We're only interested in line numbers.
-        trace: list[int] = list(map(lambda d: int(d["line"]), full_trace))
+        # We're only interested in line numbers. Path, cycles, and trigger
+        # records have none, and neither do sites without a site table.
+        trace: list[int] = [int(d["line"]) for d in full_trace if "line" in d]
         for loop in loops:
             if loop.appears_in(trace):
                 loop.occurrence += 1
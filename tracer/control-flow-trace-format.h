@@ -0,0 +1,84 @@
+// Control Flow Trace Record Format
+//
+// Every integer the tracer writes to the trace data region is a record. The
+// upper four bits of a record hold its tag, and the lower 28 bits hold its
+// payload. A site record has tag zero, so its integer is simply the site ID.
+//
+// This header is shared by the tracer runtime, the instrumentation pass, and the
+// host-side decoder, so it must only contain preprocessor definitions.
+
+#ifndef _CONTROL_FLOW_TRACE_FORMAT_H_
+#define _CONTROL_FLOW_TRACE_FORMAT_H_
+
+#define CONTROL_FLOW_TRACE_TAG_SHIFT 28
+#define CONTROL_FLOW_TRACE_PAYLOAD_MASK 0x0fffffff
+
+// Record tags.
+// The site whose ID is the payload was reached.
+#define CONTROL_FLOW_TRACE_TAG_SITE 0x0
+// The previous record was repeated payload more times in a row.
+#define CONTROL_FLOW_TRACE_TAG_REPEAT 0x1
+// The innermost loop whose site record has not been closed yet exited after
+// its header executed payload times.
+#define CONTROL_FLOW_TRACE_TAG_TRIP 0x2
+// A Ball-Larus path with the ID in the payload was completed. Path IDs are
+// unique across functions, see the "functions" section of the site table.
+#define CONTROL_FLOW_TRACE_TAG_PATH 0x3
+// payload cycles passed since the previous cycle stamp. Written right before
+// the record it stamps. Saturates at CONTROL_FLOW_TRACE_PAYLOAD_MASK.
+#define CONTROL_FLOW_TRACE_TAG_TIME 0x4
+// The trigger site in the payload was hit for the first time. Written right
+// before that site's record when capturing with the triggered policy.
+#define CONTROL_FLOW_TRACE_TAG_TRIGGER 0x5
+// The next record is a sample of the event with the sequence number in the
+// payload, counting all site and path events from one. Wraps around at 2^28.
+#define CONTROL_FLOW_TRACE_TAG_SEQUENCE 0x6
+// Marks the end of the records in the slice of a dataflow process. The entry
+// after it holds the oldest record if the payload is 1 (the slice wrapped),
+// and the first entry of the slice does otherwise.
+#define CONTROL_FLOW_TRACE_TAG_END 0x7
+// Outcomes of conditional branches (in pipelined loops, or all of them in
+// branches mode), one bit each (1 for the first successor), oldest first. The
+// bits start below the highest set bit of the payload, which only marks where
+// they begin.
+#define CONTROL_FLOW_TRACE_TAG_BRANCHES 0x8
+// The switch that the branch bits before it lead to went to its successor
+// with the index in the payload, in branches mode.
+#define CONTROL_FLOW_TRACE_TAG_TARGET 0x9
+// A field of a synchronization packet, from which the host can start decoding
+// after a wrap. The upper bits of the payload hold the field, and the lower
+// bits its value. A packet is the invocation field, then the two clock fields
+// if records are stamped, and is followed by a site or path record, whose ID is
+// absolute.
+#define CONTROL_FLOW_TRACE_TAG_SYNC 0xa
+#define CONTROL_FLOW_TRACE_SYNC_FIELD_SHIFT 24
+#define CONTROL_FLOW_TRACE_SYNC_VALUE_MASK 0x00ffffff
+// How many times the top-level function was called before, wrapping at 2^24.
+#define CONTROL_FLOW_TRACE_SYNC_INVOCATION 0x0
+// The lower and upper 16 bits of the cycles from the start of the clock to the
+// last cycle stamp, which the time records after the packet count from.
+#define CONTROL_FLOW_TRACE_SYNC_CLOCK_LOW 0x1
+#define CONTROL_FLOW_TRACE_SYNC_CLOCK_HIGH 0x2
+// The call site with the ID in the payload called an instrumented function.
+// Call site IDs index the "calls" section of the site table.
+#define CONTROL_FLOW_TRACE_TAG_CALL 0xb
+// The function called from the call site with the ID in the payload returned.
+#define CONTROL_FLOW_TRACE_TAG_RETURN 0xc
+// The detail window with the number in the payload opened (at its first
+// occurrence among the records) or closed (at its second), with
+// -controlflowtrace-hierarchical. In the detail slice, it starts the records of
+// the window, which repeat every record written while the window was open.
+#define CONTROL_FLOW_TRACE_TAG_WINDOW 0xd
+
+#define CONTROL_FLOW_TRACE_RECORD(tag, payload) \
+  ((int)(((unsigned)(tag) << CONTROL_FLOW_TRACE_TAG_SHIFT) | (unsigned)(payload)))
+#define CONTROL_FLOW_TRACE_RECORD_TAG(record) \
+  ((int)((unsigned)(record) >> CONTROL_FLOW_TRACE_TAG_SHIFT))
+#define CONTROL_FLOW_TRACE_RECORD_PAYLOAD(record) \
+  ((int)((unsigned)(record) & CONTROL_FLOW_TRACE_PAYLOAD_MASK))
+#define CONTROL_FLOW_TRACE_SYNC(field, value)                                        \
+  CONTROL_FLOW_TRACE_RECORD(CONTROL_FLOW_TRACE_TAG_SYNC,                             \
+                            ((unsigned)(field) << CONTROL_FLOW_TRACE_SYNC_FIELD_SHIFT) | \
+                            ((unsigned)(value) & CONTROL_FLOW_TRACE_SYNC_VALUE_MASK))
+
+#endif
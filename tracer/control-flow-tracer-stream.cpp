@@ -0,0 +1,25 @@
+#include "control-flow-tracer-stream.h"
+
+// The clock value at the last cycle stamp.
+static int stream_last_stamp_;
+
+void controlFlowTracerStreamRecord(hls::stream<int> &stream, int tag, int payload) {
+  if ((unsigned)payload > CONTROL_FLOW_TRACE_PAYLOAD_MASK)  // saturate
+    payload = CONTROL_FLOW_TRACE_PAYLOAD_MASK;
+  stream.write(CONTROL_FLOW_TRACE_RECORD(tag, payload));
+}
+
+void controlFlowTracerStreamStartClock(int now) {
+  stream_last_stamp_ = now;
+}
+
+void controlFlowTracerStreamStamp(hls::stream<int> &stream, int now) {
+  // Unsigned subtraction stays correct across a wrap of the clock.
+  unsigned cycles = (unsigned)now - (unsigned)stream_last_stamp_;
+  stream_last_stamp_ = now;
+  controlFlowTracerStreamRecord(stream, CONTROL_FLOW_TRACE_TAG_TIME, cycles);
+}
+
+void controlFlowTracerStreamFinish(hls::stream<int> &stream) {
+  stream.write(CONTROL_FLOW_TRACE_RECORD(CONTROL_FLOW_TRACE_TAG_END, 0));
+}
@@ -0,0 +1,41 @@
+// Control Flow Tracer, Stream Output
+//
+// A variant of the tracer for top-level functions whose first argument is an
+// hls::stream<int> (e.g. an AXI4-Stream port) instead of a trace array. Every
+// record is pushed into the stream as soon as it is made, so there is no
+// current index to update, no wrap around, and no limit on the length of the
+// trace. The consumer on the other side drains the stream while the kernel
+// runs, until it receives an end record.
+//
+// The records are the same as in the trace array (see
+// control-flow-trace-format.h). The burst, RLE, sampling, capture policy, and
+// enable mask options of control-flow-tracer.h do not apply to streams.
+
+#ifndef _CONTROL_FLOW_TRACER_STREAM_H_
+#define _CONTROL_FLOW_TRACER_STREAM_H_
+
+#include "hls_stream.h"
+#include "control-flow-trace-format.h"
+
+// The functions have C linkage, so that the pass finds them by their plain
+// names.
+extern "C" {
+
+// Pushes a record with the given tag and payload into the stream. The payload
+// saturates. Replaces the record, trip, and path calls when the trace goes to a
+// stream.
+void controlFlowTracerStreamRecord(hls::stream<int> &stream, int tag, int payload);
+// Latches the clock without writing a record, so that the first cycle stamp
+// counts from here. Called at the beginning of the top-level function when it
+// has a clock argument.
+void controlFlowTracerStreamStartClock(int now);
+// Pushes a time record with the cycles passed since the previous stamp.
+// Replaces the stamp calls when the trace goes to a stream.
+void controlFlowTracerStreamStamp(hls::stream<int> &stream, int now);
+// Pushes the end record. Called right before the return instruction of the
+// top-level function.
+void controlFlowTracerStreamFinish(hls::stream<int> &stream);
+
+}
+
+#endif
@@ -0,0 +1,32 @@
+#include "control-flow-tracer-template.h"
+
+// The size of the trace arrays in testfunctions/.
+#ifndef CONTROL_FLOW_TRACER_SIZE
+#define CONTROL_FLOW_TRACER_SIZE 260
+#endif
+
+#ifndef CONTROL_FLOW_TRACER_POLICY
+#define CONTROL_FLOW_TRACER_POLICY CONTROL_FLOW_TRACER_POLICY_RING
+#endif
+
+#ifdef CONTROL_FLOW_TRACER_RLE
+#define CONTROL_FLOW_TRACER_TEMPLATE_ARGS \
+  CONTROL_FLOW_TRACER_SIZE, CONTROL_FLOW_TRACER_POLICY, true
+#else
+#define CONTROL_FLOW_TRACER_TEMPLATE_ARGS \
+  CONTROL_FLOW_TRACER_SIZE, CONTROL_FLOW_TRACER_POLICY, false
+#endif
+
+// The pass finds these by the name of the function and the size, e.g.
+// controlFlowTracerRecordILi260E in the mangled name.
+template void controlFlowTracerInit<CONTROL_FLOW_TRACER_TEMPLATE_ARGS>(int size);
+template void controlFlowTracerRecord<CONTROL_FLOW_TRACER_TEMPLATE_ARGS>(int *array, int site);
+template void controlFlowTracerRecordTrip<CONTROL_FLOW_TRACER_TEMPLATE_ARGS>(int *array, int trips);
+template void controlFlowTracerRecordPath<CONTROL_FLOW_TRACER_TEMPLATE_ARGS>(int *array, int path);
+template void controlFlowTracerRecordBranch<CONTROL_FLOW_TRACER_TEMPLATE_ARGS>(int *array, int taken);
+template void controlFlowTracerFlushBranches<CONTROL_FLOW_TRACER_TEMPLATE_ARGS>(int *array);
+template void controlFlowTracerRecordCall<CONTROL_FLOW_TRACER_TEMPLATE_ARGS>(int *array, int call);
+template void controlFlowTracerRecordReturn<CONTROL_FLOW_TRACER_TEMPLATE_ARGS>(int *array, int call);
+template void controlFlowTracerStartClock<CONTROL_FLOW_TRACER_TEMPLATE_ARGS>(int now);
+template void controlFlowTracerStamp<CONTROL_FLOW_TRACER_TEMPLATE_ARGS>(int *array, int now);
+template void controlFlowTracerFinish<CONTROL_FLOW_TRACER_TEMPLATE_ARGS>(int *array);
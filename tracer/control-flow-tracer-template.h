@@ -0,0 +1,276 @@
+// Control Flow Tracer, Templated
+//
+// A header-only variant of the tracer whose trace array size, capture policy,
+// and run-length encoding are template parameters instead of arguments and
+// build options of one shared runtime. Every mask, period, and index of the
+// tail is then a constant expression, so Vitis HLS folds the index arithmetic
+// of every record site, including the statics the pass cannot fold for the
+// plain tracer (e.g. the synchronization period).
+//
+// control-flow-tracer-template.cpp instantiates the tracer for the size
+// CONTROL_FLOW_TRACER_SIZE (default 260), and the capture policy and RLE
+// option of control-flow-tracer.h. The instantiated functions have the names
+// and arguments of the plain tracer, with the size as their first template
+// argument, and the pass picks the ones for the size of the trace array of the
+// top-level function. hls_tracer.tcl links them instead of the plain tracer
+// when HLS_TRACER_TEMPLATED is set.
+//
+// The records and the tail of the trace array are the same as with the plain
+// tracer. Only the ring and first policies, and site, trip, path, branches,
+// call, return, time, and synchronization records are supported. The burst,
+// sampling, trigger, enable mask, dataflow process, counter, packed, and
+// detail window functions of the plain tracer have no templated counterpart,
+// so the pass stops when it needs them.
+
+#ifndef _CONTROL_FLOW_TRACER_TEMPLATE_H_
+#define _CONTROL_FLOW_TRACER_TEMPLATE_H_
+
+#include "control-flow-trace-format.h"
+
+#ifndef CONTROL_FLOW_TRACER_POLICY_RING
+#define CONTROL_FLOW_TRACER_POLICY_RING 0
+#define CONTROL_FLOW_TRACER_POLICY_FIRST 1
+#define CONTROL_FLOW_TRACER_POLICY_TRIGGER 2
+#endif
+
+namespace {
+
+// The state of one instantiation of the tracer, with the same meaning as the
+// statics of the plain tracer. It has internal linkage, so that
+// -controlflowtrace-explicit-state can gather it.
+template <int Size, int Policy, bool Rle>
+struct ControlFlowTracerState {
+  static_assert(Size > 4 && ((Size - 4) & (Size - 5)) == 0,
+                "The trace array must have 2^n + 4 entries.");
+  static_assert(Policy == CONTROL_FLOW_TRACER_POLICY_RING ||
+                    Policy == CONTROL_FLOW_TRACER_POLICY_FIRST,
+                "The templated tracer only supports the ring and first policies.");
+
+  // The number of entries the records wrap in. Value is 2^n.
+  static constexpr int kDataSize = Size - 4;
+  // A mask used to wrap current_index_. Value is 2^n - 1.
+  static constexpr int kIndexMask = kDataSize - 1;
+  // After how many words the next synchronization packet is due (never if 0).
+#ifdef CONTROL_FLOW_TRACER_SYNC_PERIOD
+  static constexpr int kSyncPeriod = CONTROL_FLOW_TRACER_SYNC_PERIOD;
+#else
+  static constexpr int kSyncPeriod = kDataSize >> 2;
+#endif
+
+  static int current_index_;
+  static int wrapped_;
+  static unsigned long long generated_;
+  static int stopped_;
+  static int last_record_;
+  static int repeats_;
+  static int branch_bits_;
+  static int last_stamp_;
+  static int start_stamp_;
+  static int clocked_;
+  static int since_sync_;
+  static int invocations_;
+};
+
+template <int Size, int Policy, bool Rle>
+int ControlFlowTracerState<Size, Policy, Rle>::current_index_;
+template <int Size, int Policy, bool Rle>
+int ControlFlowTracerState<Size, Policy, Rle>::wrapped_;
+template <int Size, int Policy, bool Rle>
+unsigned long long ControlFlowTracerState<Size, Policy, Rle>::generated_;
+template <int Size, int Policy, bool Rle>
+int ControlFlowTracerState<Size, Policy, Rle>::stopped_;
+template <int Size, int Policy, bool Rle>
+int ControlFlowTracerState<Size, Policy, Rle>::last_record_;
+template <int Size, int Policy, bool Rle>
+int ControlFlowTracerState<Size, Policy, Rle>::repeats_;
+template <int Size, int Policy, bool Rle>
+int ControlFlowTracerState<Size, Policy, Rle>::branch_bits_;
+template <int Size, int Policy, bool Rle>
+int ControlFlowTracerState<Size, Policy, Rle>::last_stamp_;
+template <int Size, int Policy, bool Rle>
+int ControlFlowTracerState<Size, Policy, Rle>::start_stamp_;
+template <int Size, int Policy, bool Rle>
+int ControlFlowTracerState<Size, Policy, Rle>::clocked_;
+template <int Size, int Policy, bool Rle>
+int ControlFlowTracerState<Size, Policy, Rle>::since_sync_;
+template <int Size, int Policy, bool Rle>
+int ControlFlowTracerState<Size, Policy, Rle>::invocations_;
+
+// Appends one word to the trace and wraps the index around the end of the
+// trace data region. Every record type goes through here.
+template <int Size, int Policy, bool Rle>
+void controlFlowTracerWrite(int *array, int word) {
+  typedef ControlFlowTracerState<Size, Policy, Rle> State;
+  if (State::generated_ != ~0ull)  // saturate
+    State::generated_ += 1;
+  if (Policy == CONTROL_FLOW_TRACER_POLICY_FIRST && State::stopped_)
+    return;
+  State::since_sync_ += 1;
+  array[State::current_index_] = word;
+  State::current_index_ += 1;
+  if ((State::current_index_ & State::kDataSize) && State::wrapped_ != 0x7fffffff)
+    State::wrapped_ += 1;
+  State::current_index_ &= State::kIndexMask;
+  if (Policy == CONTROL_FLOW_TRACER_POLICY_FIRST && State::wrapped_)
+    State::stopped_ = 1;
+}
+
+// Writes the repeat count of last_record_, if there is any.
+template <int Size, int Policy, bool Rle>
+void controlFlowTracerFlushRepeats(int *array) {
+  typedef ControlFlowTracerState<Size, Policy, Rle> State;
+  if (Rle && State::repeats_ != 0) {
+    controlFlowTracerWrite<Size, Policy, Rle>(
+        array, CONTROL_FLOW_TRACE_RECORD(CONTROL_FLOW_TRACE_TAG_REPEAT, State::repeats_));
+    State::repeats_ = 0;
+  }
+}
+
+// Appends one record to the trace, run-length encoding it against the
+// previous record if enabled.
+template <int Size, int Policy, bool Rle>
+void controlFlowTracerEmit(int *array, int record) {
+  typedef ControlFlowTracerState<Size, Policy, Rle> State;
+  if (Rle) {
+    if (record == State::last_record_) {
+      State::repeats_ += 1;
+      if (State::repeats_ == CONTROL_FLOW_TRACE_PAYLOAD_MASK)  // the count saturated
+        controlFlowTracerFlushRepeats<Size, Policy, Rle>(array);
+      return;
+    }
+    controlFlowTracerFlushRepeats<Size, Policy, Rle>(array);
+    State::last_record_ = record;
+  }
+  controlFlowTracerWrite<Size, Policy, Rle>(array, record);
+}
+
+// Writes a synchronization packet if one is due. Called right before site and
+// path records.
+template <int Size, int Policy, bool Rle>
+void controlFlowTracerSync(int *array) {
+  typedef ControlFlowTracerState<Size, Policy, Rle> State;
+  if (State::kSyncPeriod == 0 || State::since_sync_ < State::kSyncPeriod)
+    return;
+  controlFlowTracerEmit<Size, Policy, Rle>(
+      array, CONTROL_FLOW_TRACE_SYNC(CONTROL_FLOW_TRACE_SYNC_INVOCATION, State::invocations_ - 1));
+  State::since_sync_ = 0;
+  if (!State::clocked_)
+    return;
+  unsigned cycles = (unsigned)State::last_stamp_ - (unsigned)State::start_stamp_;
+  controlFlowTracerEmit<Size, Policy, Rle>(
+      array, CONTROL_FLOW_TRACE_SYNC(CONTROL_FLOW_TRACE_SYNC_CLOCK_LOW, cycles & 0xffff));
+  controlFlowTracerEmit<Size, Policy, Rle>(
+      array, CONTROL_FLOW_TRACE_SYNC(CONTROL_FLOW_TRACE_SYNC_CLOCK_HIGH, cycles >> 16));
+}
+
+}  // namespace
+
+// The functions below match the ones of the plain tracer in
+// control-flow-tracer.h. The size argument of controlFlowTracerInit is only
+// there to keep its signature, since Size is known.
+
+template <int Size, int Policy, bool Rle>
+void controlFlowTracerInit(int /* size */) {
+  typedef ControlFlowTracerState<Size, Policy, Rle> State;
+  State::current_index_ = 0;
+  State::wrapped_ = 0;
+  State::generated_ = 0;
+  State::stopped_ = 0;
+  State::last_record_ = -1;
+  State::repeats_ = 0;
+  State::branch_bits_ = 1;
+  State::last_stamp_ = 0;
+  State::start_stamp_ = 0;
+  State::clocked_ = 0;
+  // The first site or path record of an invocation starts with a packet.
+  State::since_sync_ = State::kSyncPeriod;
+  State::invocations_ += 1;
+}
+
+template <int Size, int Policy, bool Rle>
+void controlFlowTracerRecord(int *array, int site) {
+  controlFlowTracerSync<Size, Policy, Rle>(array);
+  controlFlowTracerEmit<Size, Policy, Rle>(
+      array, CONTROL_FLOW_TRACE_RECORD(CONTROL_FLOW_TRACE_TAG_SITE, site));
+}
+
+template <int Size, int Policy, bool Rle>
+void controlFlowTracerRecordTrip(int *array, int trips) {
+  if (trips > CONTROL_FLOW_TRACE_PAYLOAD_MASK)  // saturate
+    trips = CONTROL_FLOW_TRACE_PAYLOAD_MASK;
+  controlFlowTracerEmit<Size, Policy, Rle>(
+      array, CONTROL_FLOW_TRACE_RECORD(CONTROL_FLOW_TRACE_TAG_TRIP, trips));
+}
+
+template <int Size, int Policy, bool Rle>
+void controlFlowTracerRecordPath(int *array, int path) {
+  controlFlowTracerSync<Size, Policy, Rle>(array);
+  controlFlowTracerEmit<Size, Policy, Rle>(
+      array, CONTROL_FLOW_TRACE_RECORD(CONTROL_FLOW_TRACE_TAG_PATH, path));
+}
+
+template <int Size, int Policy, bool Rle>
+void controlFlowTracerRecordBranch(int *array, int taken) {
+  typedef ControlFlowTracerState<Size, Policy, Rle> State;
+  State::branch_bits_ = (State::branch_bits_ << 1) | taken;
+  if (State::branch_bits_ & (1 << (CONTROL_FLOW_TRACE_TAG_SHIFT - 1))) {
+    controlFlowTracerEmit<Size, Policy, Rle>(
+        array, CONTROL_FLOW_TRACE_RECORD(CONTROL_FLOW_TRACE_TAG_BRANCHES, State::branch_bits_));
+    State::branch_bits_ = 1;
+  }
+}
+
+template <int Size, int Policy, bool Rle>
+void controlFlowTracerFlushBranches(int *array) {
+  typedef ControlFlowTracerState<Size, Policy, Rle> State;
+  if (State::branch_bits_ != 1) {
+    controlFlowTracerEmit<Size, Policy, Rle>(
+        array, CONTROL_FLOW_TRACE_RECORD(CONTROL_FLOW_TRACE_TAG_BRANCHES, State::branch_bits_));
+    State::branch_bits_ = 1;
+  }
+}
+
+template <int Size, int Policy, bool Rle>
+void controlFlowTracerRecordCall(int *array, int call) {
+  controlFlowTracerEmit<Size, Policy, Rle>(
+      array, CONTROL_FLOW_TRACE_RECORD(CONTROL_FLOW_TRACE_TAG_CALL, call));
+}
+
+template <int Size, int Policy, bool Rle>
+void controlFlowTracerRecordReturn(int *array, int call) {
+  controlFlowTracerEmit<Size, Policy, Rle>(
+      array, CONTROL_FLOW_TRACE_RECORD(CONTROL_FLOW_TRACE_TAG_RETURN, call));
+}
+
+template <int Size, int Policy, bool Rle>
+void controlFlowTracerStartClock(int now) {
+  typedef ControlFlowTracerState<Size, Policy, Rle> State;
+  State::last_stamp_ = now;
+  State::start_stamp_ = now;
+  State::clocked_ = 1;
+}
+
+template <int Size, int Policy, bool Rle>
+void controlFlowTracerStamp(int *array, int now) {
+  typedef ControlFlowTracerState<Size, Policy, Rle> State;
+  // Unsigned subtraction stays correct across a wrap of the clock.
+  unsigned cycles = (unsigned)now - (unsigned)State::last_stamp_;
+  State::last_stamp_ = now;
+  if (cycles > CONTROL_FLOW_TRACE_PAYLOAD_MASK)  // saturate
+    cycles = CONTROL_FLOW_TRACE_PAYLOAD_MASK;
+  controlFlowTracerEmit<Size, Policy, Rle>(
+      array, CONTROL_FLOW_TRACE_RECORD(CONTROL_FLOW_TRACE_TAG_TIME, cycles));
+}
+
+template <int Size, int Policy, bool Rle>
+void controlFlowTracerFinish(int *array) {
+  typedef ControlFlowTracerState<Size, Policy, Rle> State;
+  controlFlowTracerFlushBranches<Size, Policy, Rle>(array);
+  controlFlowTracerFlushRepeats<Size, Policy, Rle>(array);
+  array[Size - 4] = State::current_index_;
+  array[Size - 3] = State::wrapped_;
+  array[Size - 2] = (int)State::generated_;
+  array[Size - 1] = (int)(State::generated_ >> 32);
+}
+
+#endif
@@ -0,0 +1,74 @@
+#include "control-flow-tracer-wide.h"
+
+// The index of the wide array where the next full word will be written.
+static int wide_index_;
+// The number of index wraps, which saturates.
+static int wide_wrapped_;
+// The number of records generated, whether they were kept or not. Saturates.
+static unsigned long long wide_generated_;
+// The size of the wide array. Value is 2^n + 1.
+static int wide_size_;
+// A mask used to wrap wide_index_. Value is 2^n - 1.
+static int wide_size_mask_;
+// A mask used to set the wrap indicator. Value is 2^n.
+static int wide_wrapped_mask_;
+// The word being filled. Records enter at the top, so once the word is full,
+// the oldest record is in the lowest 32 bits.
+static control_flow_trace_word wide_word_;
+// The number of records in wide_word_.
+static int wide_filled_;
+// The clock value at the last cycle stamp.
+static int wide_last_stamp_;
+
+void controlFlowTracerWideInit(int size) {
+  wide_index_ = 0;
+  wide_wrapped_ = 0;
+  wide_generated_ = 0;
+  wide_size_ = size;
+  wide_size_mask_ = size - 2;
+  wide_wrapped_mask_ = size - 1;
+  wide_filled_ = 0;
+}
+
+void controlFlowTracerWideRecord(control_flow_trace_word *array, int tag, int payload) {
+  if ((unsigned)payload > CONTROL_FLOW_TRACE_PAYLOAD_MASK)  // saturate
+    payload = CONTROL_FLOW_TRACE_PAYLOAD_MASK;
+  if (wide_generated_ != ~0ull)  // saturate
+    wide_generated_ += 1;
+  control_flow_trace_word record = (unsigned)CONTROL_FLOW_TRACE_RECORD(tag, payload);
+  wide_word_ = (wide_word_ >> 32) | (record << (CONTROL_FLOW_TRACER_WIDE_BITS - 32));
+  wide_filled_ += 1;
+  if (wide_filled_ == CONTROL_FLOW_TRACER_WIDE_RECORDS) {
+    array[wide_index_] = wide_word_;
+    wide_index_ += 1;
+    if ((wide_index_ & wide_wrapped_mask_) && wide_wrapped_ != 0x7fffffff)
+      wide_wrapped_ += 1;
+    wide_index_ &= wide_size_mask_;
+    wide_filled_ = 0;
+  }
+}
+
+void controlFlowTracerWideStartClock(int now) {
+  wide_last_stamp_ = now;
+}
+
+void controlFlowTracerWideStamp(control_flow_trace_word *array, int now) {
+  // Unsigned subtraction stays correct across a wrap of the clock.
+  unsigned cycles = (unsigned)now - (unsigned)wide_last_stamp_;
+  wide_last_stamp_ = now;
+  controlFlowTracerWideRecord(array, CONTROL_FLOW_TRACE_TAG_TIME, cycles);
+}
+
+void controlFlowTracerWideFinish(control_flow_trace_word *array) {
+  // Move the records of the partial word down to the lowest bits.
+  if (wide_filled_ != 0)
+    array[wide_index_] = wide_word_ >> (32 * (CONTROL_FLOW_TRACER_WIDE_RECORDS - wide_filled_));
+  control_flow_trace_word tail = 0;
+  tail.range(31, 0) = wide_index_;
+  tail.range(63, 32) = wide_wrapped_;
+  tail.range(95, 64) = wide_filled_;
+#if CONTROL_FLOW_TRACER_WIDE_BITS >= 160
+  tail.range(159, 96) = wide_generated_;
+#endif
+  array[wide_size_ - 1] = tail;
+}
@@ -0,0 +1,71 @@
+// Control Flow Tracer, Wide Output
+//
+// A variant of the tracer for top-level functions whose first argument is an
+// array of ap_uint<CONTROL_FLOW_TRACER_WIDE_BITS> (default 512) words, e.g. a
+// 512-bit m_axi port, instead of an array of int. Records are shifted into a
+// word-wide register, and a full word holding WIDE_BITS / 32 records is
+// written once every that many records, so that each write uses the whole
+// width of the bus.
+//
+// The records in a word go from the lowest 32 bits (the oldest) to the
+// highest. Like the int trace array, the wide array wraps around when full.
+//
+// IMPORTANT:
+// It is required that the size of the wide array is of the form 2^n + 1.
+// Then the first 2^n words contain trace data, and the last word is the tail:
+// bits 0-31 hold the current index (the word where the next full word would
+// have been written), bits 32-63 how many times a wrap happened (0 means
+// never), and bits 64-95 the number of records in the partial word at the
+// current index. If the word is wide enough, bits 96-159 hold the number of
+// records generated, including those that were overwritten.
+//
+// The records are the same as in the trace array (see
+// control-flow-trace-format.h). The burst, RLE, sampling, capture policy, and
+// enable mask options of control-flow-tracer.h do not apply to wide arrays.
+//
+// Build options (pass them through TRACER_FLAGS):
+// - CONTROL_FLOW_TRACER_WIDE_BITS: The width of a word of the trace array.
+//   Must be a multiple of 32 and match the type of the trace argument, e.g.
+//   1024 to write 32 records per word.
+
+#ifndef _CONTROL_FLOW_TRACER_WIDE_H_
+#define _CONTROL_FLOW_TRACER_WIDE_H_
+
+#include "ap_int.h"
+#include "control-flow-trace-format.h"
+
+#ifndef CONTROL_FLOW_TRACER_WIDE_BITS
+#define CONTROL_FLOW_TRACER_WIDE_BITS 512
+#endif
+
+// The number of records in a word.
+#define CONTROL_FLOW_TRACER_WIDE_RECORDS (CONTROL_FLOW_TRACER_WIDE_BITS / 32)
+
+typedef ap_uint<CONTROL_FLOW_TRACER_WIDE_BITS> control_flow_trace_word;
+
+// The functions have C linkage, so that the pass finds them by their plain
+// names.
+extern "C" {
+
+// Initializes the wide tracer for an array of size words. Called at the
+// beginning of the top-level function.
+void controlFlowTracerWideInit(int size);
+// Shifts a record with the given tag and payload into the current word, and
+// writes the word once it is full. The payload saturates. Replaces the record,
+// trip, and path calls when the trace array is wide.
+void controlFlowTracerWideRecord(control_flow_trace_word *array, int tag, int payload);
+// Latches the clock without writing a record, so that the first cycle stamp
+// counts from here. Called at the beginning of the top-level function when it
+// has a clock argument.
+void controlFlowTracerWideStartClock(int now);
+// Records the cycles passed since the previous stamp. Replaces the stamp calls
+// when the trace array is wide.
+void controlFlowTracerWideStamp(control_flow_trace_word *array, int now);
+// Writes the partial word at the current index without advancing it, and the
+// tail in the last word. Called right before the return instruction of the
+// top-level function.
+void controlFlowTracerWideFinish(control_flow_trace_word *array);
+
+}
+
+#endif
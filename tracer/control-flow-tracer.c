@@ -3,22 +3,529 @@
 void controlFlowTracerInit(int size) {
   current_index_ = 0;
   wrapped_ = 0;
+  generated_ = 0;
   buffer_size_ = size;
-  buffer_size_mask_ = size - 3;
-  buffer_wrapped_mask_ = size - 2;
+  buffer_size_mask_ = size - 5;
+  buffer_wrapped_mask_ = size - 4;
+  enable_mask_ = -1;
+  active_ = 1;
+  branch_bits_ = 1;
+#ifdef CONTROL_FLOW_TRACER_PACKED
+  packed_ = ~0u;
+  packed_bits_ = 0;
+#endif
+  last_stamp_ = 0;
+  start_stamp_ = 0;
+  clocked_ = 0;
+#ifdef CONTROL_FLOW_TRACER_SYNC_PERIOD
+  sync_period_ = CONTROL_FLOW_TRACER_SYNC_PERIOD;
+#else
+  sync_period_ = (size - 4) >> 2;
+#endif
+  // The first site or path record of an invocation starts with a packet.
+  since_sync_ = sync_period_;
+  invocations_ += 1;
+#ifdef CONTROL_FLOW_TRACER_BURST_LENGTH
+  staged_ = 0;
+#endif
+#ifdef CONTROL_FLOW_TRACER_RLE
+  last_record_ = -1;
+  repeats_ = 0;
+#endif
+#if CONTROL_FLOW_TRACER_POLICY != CONTROL_FLOW_TRACER_POLICY_RING
+  stopped_ = 0;
+#endif
+#ifdef CONTROL_FLOW_TRACER_SAMPLE_PERIOD
+  lfsr_ = 0xace1u;
+  sample_mask_ = CONTROL_FLOW_TRACER_SAMPLE_PERIOD - 1;
+  events_ = 0;
+#endif
+#if CONTROL_FLOW_TRACER_POLICY == CONTROL_FLOW_TRACER_POLICY_TRIGGER
+  triggered_ = 0;
+#ifdef CONTROL_FLOW_TRACER_POST_TRIGGER
+  post_trigger_ = CONTROL_FLOW_TRACER_POST_TRIGGER;
+#else
+  post_trigger_ = (size - 4) >> 1;
+#endif
+#endif
 }
 
-void controlFlowTracerRecord(int *array, int row, int column) {
+// Advances current_index_ by the given number of written entries and wraps it
+// around the end of the trace data region. Also decides whether capture stops
+// according to the capture policy.
+static void controlFlowTracerAdvance(int count) {
+  current_index_ += count;
+  // bitwise-and is non-zero when current_index_ >= 2^n
+  if ((current_index_ & buffer_wrapped_mask_) && wrapped_ != 0x7fffffff)
+    wrapped_ += 1;
+  current_index_ &= buffer_size_mask_; // bitwise-and ensures current_index_ range 0 ~ 2^n - 1
+#if CONTROL_FLOW_TRACER_POLICY == CONTROL_FLOW_TRACER_POLICY_FIRST
+  // The array is full. Since current_index_ is back at zero, the host still
+  // reads the records in order starting from there.
+  if (wrapped_)
+    stopped_ = 1;
+#elif CONTROL_FLOW_TRACER_POLICY == CONTROL_FLOW_TRACER_POLICY_TRIGGER
+  if (triggered_) {
+    post_trigger_ -= count;
+    if (post_trigger_ <= 0)
+      stopped_ = 1;
+  }
+#endif
+}
+
+#ifdef CONTROL_FLOW_TRACER_BURST_LENGTH
+// Copies the staged records to the trace array. The copy is a plain
+// sequential loop so that Vitis HLS infers a single burst for it. Since the
+// burst length divides 2^n and full bursts are always written at multiples
+// of it, a burst never straddles the end of the trace data region.
+static void controlFlowTracerFlush(int *array) {
+  for (int i = 0; i < staged_; i++) {
+#pragma HLS pipeline II=1
+#pragma HLS loop_tripcount max=CONTROL_FLOW_TRACER_BURST_LENGTH
+    array[current_index_ + i] = staging_[i];
+  }
+  controlFlowTracerAdvance(staged_);
+  staged_ = 0;
+}
+#endif
+
+// Appends one word to the trace. Every record type goes through here.
+static void controlFlowTracerWrite(int *array, int word) {
+  if (generated_ != ~0ull)  // saturate
+    generated_ += 1;
+#if CONTROL_FLOW_TRACER_POLICY != CONTROL_FLOW_TRACER_POLICY_RING
+  if (stopped_)
+    return;
+#endif
+  since_sync_ += 1;
+#ifdef CONTROL_FLOW_TRACER_BURST_LENGTH
+  staging_[staged_] = word;
+  staged_ += 1;
+  if (staged_ == CONTROL_FLOW_TRACER_BURST_LENGTH)
+    controlFlowTracerFlush(array);
+#else
+  array[current_index_] = word;
+  controlFlowTracerAdvance(1);
+#endif
+}
+
+#ifdef CONTROL_FLOW_TRACER_RLE
+// Writes the repeat count of last_record_, if there is any.
+static void controlFlowTracerFlushRepeats(int *array) {
+  if (repeats_ != 0) {
+    controlFlowTracerWrite(array, CONTROL_FLOW_TRACE_RECORD(CONTROL_FLOW_TRACE_TAG_REPEAT, repeats_));
+    repeats_ = 0;
+  }
+}
+#endif
+
+// Appends one record to the trace, run-length encoding it against the
+// previous record if enabled.
+static void controlFlowTracerEncode(int *array, int record) {
+#ifdef CONTROL_FLOW_TRACER_RLE
+  if (record == last_record_) {
+    repeats_ += 1;
+    if (repeats_ == CONTROL_FLOW_TRACE_PAYLOAD_MASK)  // the count saturated
+      controlFlowTracerFlushRepeats(array);
+    return;
+  }
+  controlFlowTracerFlushRepeats(array);
+  last_record_ = record;
+#endif
+  controlFlowTracerWrite(array, record);
+}
+
+#ifdef CONTROL_FLOW_TRACER_HIERARCHICAL
+// Appends one word to the detail slice, which starts right after the slice the
+// other records wrap in.
+static void controlFlowTracerDetailWrite(int *array, int word) {
+  array[buffer_wrapped_mask_ + detail_index_] = word;
+  detail_index_ = (detail_index_ + 1) & buffer_size_mask_;
+  if (detail_index_ == 0)
+    detail_wrapped_ = 1;
+}
+
+// Appends one word to the open detail window, and closes the window once it is
+// full.
+static void controlFlowTracerWindowWrite(int *array, int word) {
+  controlFlowTracerDetailWrite(array, word);
+  window_left_ -= 1;
+  if (window_left_ == 0)
+    controlFlowTracerEncode(array, CONTROL_FLOW_TRACE_RECORD(CONTROL_FLOW_TRACE_TAG_WINDOW, windows_));
+}
+#endif
+
+// Appends one record to the trace, and repeats it in the open detail window.
+static void controlFlowTracerEmit(int *array, int record) {
+  controlFlowTracerEncode(array, record);
+#ifdef CONTROL_FLOW_TRACER_HIERARCHICAL
+  if (window_left_ != 0)
+    controlFlowTracerWindowWrite(array, record);
+#endif
+}
+
+#ifdef CONTROL_FLOW_TRACER_SAMPLE_PERIOD
+// Counts one site or path event and decides whether it is sampled. If so, the
+// sequence record of the event is written before returning 1.
+static int controlFlowTracerSample(int *array) {
+  events_ += 1;
+  // Galois LFSR with taps 32, 22, 2, 1, which has the maximal period. One
+  // step only shifts the masked bits by one, so that consecutive events would
+  // be sampled together. Leaping a whole word per event gives every event
+  // fresh bits, and the unrolled steps are just XORs.
+  for (int i = 0; i < 32; i++) {
+#pragma HLS unroll
+    lfsr_ = (lfsr_ >> 1) ^ (-(lfsr_ & 1u) & 0x80200003u);
+  }
+  if ((lfsr_ & sample_mask_) != 0)
+    return 0;
+  controlFlowTracerEmit(array, CONTROL_FLOW_TRACE_RECORD(CONTROL_FLOW_TRACE_TAG_SEQUENCE,
+                                                         events_ & CONTROL_FLOW_TRACE_PAYLOAD_MASK));
+  return 1;
+}
+#endif
+
+// Writes a synchronization packet if one is due. Called right before site and
+// path records, whose IDs do not depend on any record before them.
+static void controlFlowTracerSync(int *array) {
+  if (sync_period_ == 0 || since_sync_ < sync_period_)
+    return;
+  controlFlowTracerEmit(array, CONTROL_FLOW_TRACE_SYNC(CONTROL_FLOW_TRACE_SYNC_INVOCATION, invocations_ - 1));
+  since_sync_ = 0;
+  // The last stamp is only the current time while records are stamped, which
+  // they never are in sampled builds.
+#ifndef CONTROL_FLOW_TRACER_SAMPLE_PERIOD
+  if (!clocked_)
+    return;
+  unsigned cycles = (unsigned)last_stamp_ - (unsigned)start_stamp_;
+  controlFlowTracerEmit(array, CONTROL_FLOW_TRACE_SYNC(CONTROL_FLOW_TRACE_SYNC_CLOCK_LOW, cycles & 0xffff));
+  controlFlowTracerEmit(array, CONTROL_FLOW_TRACE_SYNC(CONTROL_FLOW_TRACE_SYNC_CLOCK_HIGH, cycles >> 16));
+#endif
+}
+
+void controlFlowTracerRecord(int *array, int site) {
   // Jae-Won: All operations in this function must be as simple and
   // hardware-friendly as possible.
-  array[current_index_] = row;
-  array[current_index_ + 1] = column;
-  current_index_ += 2;
-  wrapped_ |= (current_index_ & buffer_wrapped_mask_);  // bitwise-and is non-zero when current_index_ >= 2^n
-  current_index_ &= buffer_size_mask_; // bitwise-and ensures current_index_ range 0 ~ 2^n - 1
+  if (!active_)
+    return;
+  controlFlowTracerSync(array);
+#if CONTROL_FLOW_TRACER_POLICY == CONTROL_FLOW_TRACER_POLICY_TRIGGER
+  if (!triggered_ && site == CONTROL_FLOW_TRACER_TRIGGER_SITE) {
+    controlFlowTracerEmit(array, CONTROL_FLOW_TRACE_RECORD(CONTROL_FLOW_TRACE_TAG_TRIGGER, site));
+    triggered_ = 1;
+    if (post_trigger_ <= 0)
+      stopped_ = 1;
+  }
+#endif
+#ifdef CONTROL_FLOW_TRACER_SAMPLE_PERIOD
+  if (!controlFlowTracerSample(array))
+    return;
+#endif
+  controlFlowTracerEmit(array, CONTROL_FLOW_TRACE_RECORD(CONTROL_FLOW_TRACE_TAG_SITE, site));
+}
+
+void controlFlowTracerRecordTrip(int *array, int trips) {
+#ifdef CONTROL_FLOW_TRACER_SAMPLE_PERIOD
+  return;  // a sampled loop entry would get the trip count of another loop
+#endif
+  if (!active_)
+    return;
+  if (trips > CONTROL_FLOW_TRACE_PAYLOAD_MASK)  // saturate
+    trips = CONTROL_FLOW_TRACE_PAYLOAD_MASK;
+  controlFlowTracerEmit(array, CONTROL_FLOW_TRACE_RECORD(CONTROL_FLOW_TRACE_TAG_TRIP, trips));
+}
+
+void controlFlowTracerRecordPath(int *array, int path) {
+  if (!active_)
+    return;
+  controlFlowTracerSync(array);
+#ifdef CONTROL_FLOW_TRACER_SAMPLE_PERIOD
+  if (!controlFlowTracerSample(array))
+    return;
+#endif
+  controlFlowTracerEmit(array, CONTROL_FLOW_TRACE_RECORD(CONTROL_FLOW_TRACE_TAG_PATH, path));
+}
+
+void controlFlowTracerRecordBranch(int *array, int taken) {
+#ifdef CONTROL_FLOW_TRACER_SAMPLE_PERIOD
+  return;  // the bits would belong to an unsampled loop entry
+#endif
+  if (!active_)
+    return;
+  // Only the shift is on the loop's critical path. The write happens once
+  // every 27 branches.
+  branch_bits_ = (branch_bits_ << 1) | taken;
+  if (branch_bits_ & (1 << (CONTROL_FLOW_TRACE_TAG_SHIFT - 1))) {
+    controlFlowTracerEmit(array, CONTROL_FLOW_TRACE_RECORD(CONTROL_FLOW_TRACE_TAG_BRANCHES, branch_bits_));
+    branch_bits_ = 1;
+  }
+}
+
+void controlFlowTracerFlushBranches(int *array) {
+  if (branch_bits_ != 1) {
+    controlFlowTracerEmit(array, CONTROL_FLOW_TRACE_RECORD(CONTROL_FLOW_TRACE_TAG_BRANCHES, branch_bits_));
+    branch_bits_ = 1;
+  }
+}
+
+void controlFlowTracerRecordTarget(int *array, int target) {
+#ifdef CONTROL_FLOW_TRACER_SAMPLE_PERIOD
+  return;  // without the branch bits, a target cannot be placed
+#endif
+  if (!active_)
+    return;
+  controlFlowTracerFlushBranches(array);
+  controlFlowTracerEmit(array, CONTROL_FLOW_TRACE_RECORD(CONTROL_FLOW_TRACE_TAG_TARGET, target));
+}
+
+void controlFlowTracerRecordCall(int *array, int call) {
+  if (!active_)
+    return;
+  controlFlowTracerEmit(array, CONTROL_FLOW_TRACE_RECORD(CONTROL_FLOW_TRACE_TAG_CALL, call));
+}
+
+void controlFlowTracerRecordReturn(int *array, int call) {
+  if (!active_)
+    return;
+  controlFlowTracerEmit(array, CONTROL_FLOW_TRACE_RECORD(CONTROL_FLOW_TRACE_TAG_RETURN, call));
+}
+
+#ifdef CONTROL_FLOW_TRACER_PACKED
+void controlFlowTracerRecordPacked(int *array, int site, int width) {
+#pragma HLS inline
+  if (!active_)
+    return;
+  unsigned mask = (1u << width) - 1;
+  packed_ = (packed_ & ~(mask << packed_bits_)) | ((unsigned)site << packed_bits_);
+  packed_bits_ += width;
+  if (packed_bits_ + width > 32) {
+    controlFlowTracerWrite(array, packed_);
+    packed_ = ~0u;  // unused fields read as the all-ones ID
+    packed_bits_ = 0;
+  }
+}
+#endif
+
+void controlFlowTracerSetSamplePeriod(int period) {
+#ifdef CONTROL_FLOW_TRACER_SAMPLE_PERIOD
+  sample_mask_ = period - 1;
+#else
+  (void)period;
+#endif
+}
+
+void controlFlowTracerEnable(int mask) {
+  enable_mask_ = mask;
+}
+
+void controlFlowTracerEnter(int region) {
+  active_ = (enable_mask_ >> region) & 1;
+}
+
+void controlFlowTracerStartClock(int now) {
+  last_stamp_ = now;
+  start_stamp_ = now;
+  clocked_ = 1;
+#ifdef CONTROL_FLOW_TRACER_CHANNELS
+  for (int i = 0; i < CONTROL_FLOW_TRACER_MAX_CHANNELS; i++) {
+#pragma HLS unroll
+    channel_stamp_[i] = now;
+  }
+#endif
+}
+
+void controlFlowTracerStamp(int *array, int now) {
+#ifdef CONTROL_FLOW_TRACER_SAMPLE_PERIOD
+  return;  // the cycles between two samples belong to no single record
+#endif
+  // Unsigned subtraction stays correct across a wrap of the clock.
+  unsigned cycles = (unsigned)now - (unsigned)last_stamp_;
+  last_stamp_ = now;
+  if (!active_)
+    return;
+  if (cycles > CONTROL_FLOW_TRACE_PAYLOAD_MASK)  // saturate
+    cycles = CONTROL_FLOW_TRACE_PAYLOAD_MASK;
+  controlFlowTracerEmit(array, CONTROL_FLOW_TRACE_RECORD(CONTROL_FLOW_TRACE_TAG_TIME, cycles));
+}
+
+void controlFlowTracerInitChannels(int *array, int channels, int slice) {
+  buffer_size_mask_ = slice - 1;
+  buffer_wrapped_mask_ = slice;
+#ifndef CONTROL_FLOW_TRACER_SYNC_PERIOD
+  sync_period_ = slice >> 2;
+  since_sync_ = sync_period_;
+#endif
+#ifdef CONTROL_FLOW_TRACER_CHANNELS
+  for (int i = 1; i <= channels; i++) {
+#pragma HLS loop_tripcount max=CONTROL_FLOW_TRACER_MAX_CHANNELS
+    channel_index_[i] = 0;
+    channel_wrapped_[i] = 0;
+    array[i * slice] = CONTROL_FLOW_TRACE_RECORD(CONTROL_FLOW_TRACE_TAG_END, 0);
+  }
+#else
+  (void)array;
+  (void)channels;
+#endif
+}
+
+#ifdef CONTROL_FLOW_TRACER_CHANNELS
+void controlFlowTracerChannelRecord(int *array, int channel, int slice, int tag, int payload) {
+  // Inlining makes channel a constant, so each process gets its own registers.
+#pragma HLS inline
+#pragma HLS array_partition variable=channel_index_ complete
+#pragma HLS array_partition variable=channel_wrapped_ complete
+  if ((unsigned)payload > CONTROL_FLOW_TRACE_PAYLOAD_MASK)  // saturate
+    payload = CONTROL_FLOW_TRACE_PAYLOAD_MASK;
+  int index = channel_index_[channel];
+  array[channel * slice + index] = CONTROL_FLOW_TRACE_RECORD(tag, payload);
+  index += 1;
+  channel_wrapped_[channel] |= index & slice;
+  channel_index_[channel] = index & (slice - 1);
+}
+
+void controlFlowTracerChannelStamp(int *array, int channel, int slice, int now) {
+#pragma HLS inline
+#pragma HLS array_partition variable=channel_stamp_ complete
+  unsigned cycles = (unsigned)now - (unsigned)channel_stamp_[channel];
+  channel_stamp_[channel] = now;
+  controlFlowTracerChannelRecord(array, channel, slice, CONTROL_FLOW_TRACE_TAG_TIME, cycles);
+}
+
+void controlFlowTracerChannelFinish(int *array, int channel, int slice) {
+#pragma HLS inline
+  array[channel * slice + channel_index_[channel]] =
+      CONTROL_FLOW_TRACE_RECORD(CONTROL_FLOW_TRACE_TAG_END, channel_wrapped_[channel] ? 1 : 0);
+}
+#endif
+
+#ifdef CONTROL_FLOW_TRACER_HIERARCHICAL
+void controlFlowTracerInitDetail(int *array) {
+  detail_index_ = 0;
+  detail_wrapped_ = 0;
+  window_left_ = 0;
+#ifdef CONTROL_FLOW_TRACER_WINDOW_LENGTH
+  window_length_ = CONTROL_FLOW_TRACER_WINDOW_LENGTH;
+#else
+  window_length_ = buffer_wrapped_mask_ >> 2;
+#endif
+  windows_ = 0;
+  // The first coarse site record of an invocation opens a window.
+  window_events_ = CONTROL_FLOW_TRACER_WINDOW_PERIOD;
+  array[buffer_wrapped_mask_] = CONTROL_FLOW_TRACE_RECORD(CONTROL_FLOW_TRACE_TAG_END, 0);
+}
+
+void controlFlowTracerOpenWindow(int *array, int site) {
+  if (!active_)
+    return;
+  window_events_ += 1;
+#ifdef CONTROL_FLOW_TRACER_WINDOW_SITE
+  if (site == CONTROL_FLOW_TRACER_WINDOW_SITE)
+    window_events_ = CONTROL_FLOW_TRACER_WINDOW_PERIOD;
+#else
+  (void)site;
+#endif
+  if (window_left_ != 0 || window_events_ < CONTROL_FLOW_TRACER_WINDOW_PERIOD)
+    return;
+  window_events_ = 0;
+  windows_ = (windows_ + 1) & CONTROL_FLOW_TRACE_PAYLOAD_MASK;
+  int marker = CONTROL_FLOW_TRACE_RECORD(CONTROL_FLOW_TRACE_TAG_WINDOW, windows_);
+  controlFlowTracerEncode(array, marker);
+  // The marker does not count toward the length of the window.
+  controlFlowTracerDetailWrite(array, marker);
+  window_left_ = window_length_;
+}
+
+void controlFlowTracerRecordDetail(int *array, int site) {
+  if (!active_ || window_left_ == 0)
+    return;
+  controlFlowTracerWindowWrite(array, CONTROL_FLOW_TRACE_RECORD(CONTROL_FLOW_TRACE_TAG_SITE, site));
+}
+
+void controlFlowTracerFinishDetail(int *array) {
+  controlFlowTracerFlushBranches(array);
+  if (window_left_ != 0) {
+    controlFlowTracerEncode(array, CONTROL_FLOW_TRACE_RECORD(CONTROL_FLOW_TRACE_TAG_WINDOW, windows_));
+    window_left_ = 0;
+  }
+  array[buffer_wrapped_mask_ + detail_index_] =
+      CONTROL_FLOW_TRACE_RECORD(CONTROL_FLOW_TRACE_TAG_END, detail_wrapped_);
+}
+#endif
+
+#ifdef CONTROL_FLOW_TRACER_SIGNATURE
+void controlFlowTracerInitSignature() {
+  signature_ = ~0u;
+  signature_records_ = 0;
+}
+
+void controlFlowTracerFold(int tag, int payload) {
+  if ((unsigned)payload > CONTROL_FLOW_TRACE_PAYLOAD_MASK)  // saturate
+    payload = CONTROL_FLOW_TRACE_PAYLOAD_MASK;
+  // CRC-32 (reflected, polynomial 0xedb88320) over the 32 bits of the record.
+  // Unrolled, each bit of the result is an XOR of bits of the record and the
+  // old CRC, so a fold takes a single cycle.
+  unsigned crc = signature_ ^ (unsigned)CONTROL_FLOW_TRACE_RECORD(tag, payload);
+  for (int i = 0; i < 32; i++) {
+#pragma HLS unroll
+    crc = (crc >> 1) ^ (0xedb88320u & -(crc & 1u));
+  }
+  signature_ = crc;
+  if (signature_records_ != ~0u)
+    signature_records_ += 1;
+}
+
+void controlFlowTracerFinishSignature(int *array) {
+  array[0] = (int)~signature_;
+  array[1] = (int)signature_records_;
+}
+#endif
+
+#ifdef CONTROL_FLOW_TRACER_COUNTERS
+void controlFlowTracerClearCounters(int count) {
+  for (int i = 0; i < count; i++) {
+#pragma HLS loop_tripcount max=CONTROL_FLOW_TRACER_MAX_COUNTERS
+    counters_[i] = 0;
+  }
+}
+
+void controlFlowTracerCount(int counter) {
+  if (!active_)
+    return;
+  counters_[counter] += 1;
+}
+
+void controlFlowTracerFlushCounters(int *array, int count) {
+  for (int i = 0; i < count; i++) {
+#pragma HLS pipeline II=1
+#pragma HLS loop_tripcount max=CONTROL_FLOW_TRACER_MAX_COUNTERS
+    array[i] = counters_[i];
+  }
+  current_index_ = count;
+}
+
+void controlFlowTracerFlushHistogram(int *array, int offset, int count) {
+  for (int i = 0; i < count; i++) {
+#pragma HLS pipeline II=1
+#pragma HLS loop_tripcount max=CONTROL_FLOW_TRACER_MAX_COUNTERS
+    array[offset + i] = counters_[i];
+  }
 }
+#endif
 
 void controlFlowTracerFinish(int *array) {
-  array[buffer_size_ - 2] = current_index_; 
-  array[buffer_size_ - 1] = wrapped_ ? 1 : 0;
+  controlFlowTracerFlushBranches(array);
+#ifdef CONTROL_FLOW_TRACER_PACKED
+  if (packed_bits_ != 0)
+    controlFlowTracerWrite(array, packed_);
+#endif
+#ifdef CONTROL_FLOW_TRACER_RLE
+  controlFlowTracerFlushRepeats(array);
+#endif
+#ifdef CONTROL_FLOW_TRACER_BURST_LENGTH
+  controlFlowTracerFlush(array);
+#endif
+  array[buffer_size_ - 4] = current_index_;
+  array[buffer_size_ - 3] = wrapped_;
+  array[buffer_size_ - 2] = (int)generated_;
+  array[buffer_size_ - 1] = (int)(generated_ >> 32);
 }
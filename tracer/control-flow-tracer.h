@@ -1,39 +1,229 @@
 // Control Flow Tracer
 //
 // The goal of the tracer is to accumulate control flow trace (a sequence
-// of [line number, column number]) of the high-level source code executed 
-// inside hardware.
-//
-// The tracer consists of three functions that implement the behavior of
-// the tracer and five static variables that enclose the state of the tracer.
+// of site IDs) of the high-level source code executed inside hardware.
+// A site ID is a dense integer the instrumentation pass assigns to every
+// record location. The pass also writes a site table that maps each ID back
+// to its file, function, line, column, and basic block, so that the host
+// can decode the trace.
 //
 // Trace will be written to an integer array sequentially. When the array is
 // full, the tracer will wrap around and overwrite from the beginning. This
 // information needs to be conveyed to the user who will only have access to
-// an array of integers. Thus, the last two entries of the trace array is
+// an array of integers. Thus, the last four entries of the trace array are
 // reserved for 1) the current index (where the next trace data would have
-// been written) and 2) whether a wrap ever happened (1 means happened).
+// been written), 2) how many times a wrap happened (0 means never), and 3-4)
+// the lower and upper 32 bits of the number of words the tracer generated,
+// including those that were overwritten or dropped. The host can tell from
+// them how much of the run the trace covers.
 //
 // IMPORTANT:
-// It is required that the size of the buffer is of the form 2^n + 2.
-// Then the first 2^n entries will contain trace data (2^(n-1) records since
-// one record writes two integers, line number and column number). Then
-// the later two entries each contain the current index and the wrap indicator.
+// It is required that the size of the buffer is of the form 2^n + 4.
+// Then the first 2^n entries will contain trace data (2^n records since
+// one record writes a single integer, the site ID). Then the later four
+// entries contain the current index, the wrap count, and the word count.
+//
+// Build options (pass them through TRACER_FLAGS, e.g.
+// `make TRACER_FLAGS=-DCONTROL_FLOW_TRACER_BURST_LENGTH=16`):
+// - CONTROL_FLOW_TRACER_BURST_LENGTH: Write records in bursts of this many
+//   entries. A power of two no larger than 2^n.
+// - CONTROL_FLOW_TRACER_RLE: Run-length encode repeated records.
+// - CONTROL_FLOW_TRACER_POLICY: Which records to keep when there are more than
+//   2^n of them (CONTROL_FLOW_TRACER_POLICY_RING by default).
+// - CONTROL_FLOW_TRACER_TRIGGER_SITE, CONTROL_FLOW_TRACER_POST_TRIGGER: The
+//   trigger site, and how many records to keep after it (default 2^(n-1)).
+// - CONTROL_FLOW_TRACER_SAMPLE_PERIOD: Record about one in this many site and
+//   path events. A power of two.
+// - CONTROL_FLOW_TRACER_SYNC_PERIOD: Words between synchronization packets
+//   (default 2^n / 4). 0 disables them.
+// - CONTROL_FLOW_TRACER_HIERARCHICAL: Build the detail slice and its windows.
+//   hls_tracer.tcl sets it with -controlflowtrace-hierarchical.
+// - CONTROL_FLOW_TRACER_WINDOW_PERIOD: Coarse site records between detail
+//   windows (default 64).
+// - CONTROL_FLOW_TRACER_WINDOW_SITE: A coarse site that always opens a window.
+// - CONTROL_FLOW_TRACER_WINDOW_LENGTH: Words of the detail slice per window
+//   (default a quarter of the slice). Less than the slice.
+// - CONTROL_FLOW_TRACER_PACKED: Build the packing of site records.
+//   hls_tracer.tcl sets it with -controlflowtrace-pack-sites.
+// - CONTROL_FLOW_TRACER_SIGNATURE: Build the path signature.
+//   hls_tracer.tcl sets it with -controlflowtrace-signature.
+// - CONTROL_FLOW_TRACER_CHANNELS: Build the channel cursors of dataflow
+//   processes. hls_tracer.tcl sets it when the user code has a dataflow region.
+// - CONTROL_FLOW_TRACER_MAX_CHANNELS: Dataflow processes plus one (default 8).
+//   Must match -controlflowtrace-max-channels of the pass.
+// - CONTROL_FLOW_TRACER_COUNTERS: Build the on-chip counter array.
+//   hls_tracer.tcl sets it in edges mode and with -controlflowtrace-histogram.
+// - CONTROL_FLOW_TRACER_MAX_COUNTERS: Size of the counter array (default 256).
+//   Must match -controlflowtrace-max-counters of the pass.
+//
+// See control-flow-trace-format.h for how records are encoded.
 
 #ifndef _CONTROL_FLOW_TRACER_H_
 #define _CONTROL_FLOW_TRACER_H_
 
+#include "control-flow-trace-format.h"
+
+// With -controlflowtrace-explicit-state, the pass gathers the statics below
+// into a struct per kernel, and passes it to every tracer function.
+
 // The index of the trace array where the next write will happen.
 static int current_index_;
-// A boolean indicator that shows whether an index wrap occurred.
+// The number of index wraps, which saturates. Non-zero means that a wrap
+// occurred.
 static int wrapped_;
-// The size of the trace array. Value is 2^n + 2.
+// The number of words generated, whether they were kept or not. Saturates.
+static unsigned long long generated_;
+// The size of the trace array. Value is 2^n + 4.
+// This and the two masks below only depend on the size of the trace array,
+// which the pass knows, so it folds them into constants.
 static int buffer_size_;
 // A mask used to wrap current_index_. Value is 2^n - 1.
 static int buffer_size_mask_;
 // A mask used to set the wrap indicator. Value is 2^n.
 static int buffer_wrapped_mask_;
 
+#ifdef CONTROL_FLOW_TRACER_COUNTERS
+#ifndef CONTROL_FLOW_TRACER_MAX_COUNTERS
+#define CONTROL_FLOW_TRACER_MAX_COUNTERS 256
+#endif
+
+// On-chip edge counters in edges mode, and site hit counters with
+// -controlflowtrace-histogram, which are copied to the second half of the
+// trace data region at finish while the records wrap in the first half.
+static int counters_[CONTROL_FLOW_TRACER_MAX_COUNTERS];
+#endif
+
+#define CONTROL_FLOW_TRACER_POLICY_RING 0
+#define CONTROL_FLOW_TRACER_POLICY_FIRST 1
+#define CONTROL_FLOW_TRACER_POLICY_TRIGGER 2
+
+#ifndef CONTROL_FLOW_TRACER_POLICY
+#define CONTROL_FLOW_TRACER_POLICY CONTROL_FLOW_TRACER_POLICY_RING
+#endif
+
+// RING wraps around and keeps the last 2^n records, FIRST stops once 2^n were
+// written, and TRIGGER wraps until the trigger site is hit, writes a trigger
+// record, and stops after the post-trigger records. Only stops at a burst
+// boundary.
+#if CONTROL_FLOW_TRACER_POLICY != CONTROL_FLOW_TRACER_POLICY_RING
+// A boolean indicator that shows whether capture has stopped.
+static int stopped_;
+#endif
+
+#if CONTROL_FLOW_TRACER_POLICY == CONTROL_FLOW_TRACER_POLICY_TRIGGER
+#ifndef CONTROL_FLOW_TRACER_TRIGGER_SITE
+#error "CONTROL_FLOW_TRACER_POLICY_TRIGGER requires CONTROL_FLOW_TRACER_TRIGGER_SITE."
+#endif
+// A boolean indicator that shows whether the trigger site was hit.
+static int triggered_;
+// How many more entries to write after the trigger before capture stops.
+static int post_trigger_;
+#endif
+
+// Each sampled site or path record follows a sequence record, so that the host
+// can scale counts back up. Trip, time, and branches records are not written.
+#ifdef CONTROL_FLOW_TRACER_SAMPLE_PERIOD
+// State of the sampling LFSR. Never zero.
+static unsigned lfsr_;
+// An event is sampled when the LFSR bits under this mask are all zero.
+// Value is the sample period - 1.
+static unsigned sample_mask_;
+// The number of site and path events so far, sampled or not.
+static int events_;
+#endif
+
+// Bit r enables recording in region r, i.e. the instrumented function numbered
+// r in the site table (31 and up share bit 31). All bits are set unless the
+// top-level function has an enable argument.
+static int enable_mask_;
+// A boolean indicator that shows whether the current region is enabled.
+static int active_;
+
+#ifdef CONTROL_FLOW_TRACER_CHANNELS
+#ifndef CONTROL_FLOW_TRACER_MAX_CHANNELS
+#define CONTROL_FLOW_TRACER_MAX_CHANNELS 8
+#endif
+
+// Per-channel copies of current_index_, wrapped_, and last_stamp_, indexed by
+// the channel. Each dataflow process writes plain records to its own slice of
+// the trace data region, and slice 0 is left to the variables above. These
+// are partitioned into registers, so that each process only touches its own.
+static int channel_index_[CONTROL_FLOW_TRACER_MAX_CHANNELS];
+static int channel_wrapped_[CONTROL_FLOW_TRACER_MAX_CHANNELS];
+static int channel_stamp_[CONTROL_FLOW_TRACER_MAX_CHANNELS];
+#endif
+
+// Branch outcomes of pipelined loops, and of every branch in branches mode, not
+// written yet, below a leading one that marks where they begin. Written as a
+// branches record once it holds 27 bits. Value is 1 when there are none.
+static int branch_bits_;
+
+#ifdef CONTROL_FLOW_TRACER_PACKED
+// Site records packed into one word, and the number of bits used. The first
+// record is in the lowest bits, and unused fields hold the all-ones ID.
+static unsigned packed_;
+static int packed_bits_;
+#endif
+
+// The clock value at the last cycle stamp, and when the clock started. Records
+// are stamped in functions with a trace_clock argument.
+static int last_stamp_;
+static int start_stamp_;
+// Whether the clock was started, i.e. records are stamped, so that
+// synchronization packets carry the time of the last stamp.
+static int clocked_;
+
+// The number of words written since the last synchronization packet, and
+// after how many words the next one is due (never if 0). The first site or
+// path record of every invocation also gets a packet.
+static int since_sync_;
+static int sync_period_;
+// How many times the top-level function was called. Not reset by
+// controlFlowTracerInit.
+static int invocations_;
+
+#ifdef CONTROL_FLOW_TRACER_HIERARCHICAL
+#ifndef CONTROL_FLOW_TRACER_WINDOW_PERIOD
+#define CONTROL_FLOW_TRACER_WINDOW_PERIOD 64
+#endif
+
+// With -controlflowtrace-hierarchical, basic block records only go to the
+// detail slice, the second half, while a window is open, and window records
+// mark the window among the coarse records in the first half.
+
+// The cursor and the wrap indicator of the detail slice, how many more words
+// the open detail window takes (0 if none is open), and how many it takes in
+// total.
+static int detail_index_;
+static int detail_wrapped_;
+static int window_left_;
+static int window_length_;
+// The number of the last window, and the coarse site records since it opened.
+static int windows_;
+static int window_events_;
+#endif
+
+#ifdef CONTROL_FLOW_TRACER_SIGNATURE
+// The CRC of the records folded so far, and how many there were, which are the
+// only two words written with -controlflowtrace-signature. The count saturates.
+static unsigned signature_;
+static unsigned signature_records_;
+#endif
+
+#ifdef CONTROL_FLOW_TRACER_BURST_LENGTH
+// On-chip staging buffer holding records not yet written to the trace array.
+static int staging_[CONTROL_FLOW_TRACER_BURST_LENGTH];
+// The number of valid records in staging_.
+static int staged_;
+#endif
+
+#ifdef CONTROL_FLOW_TRACER_RLE
+// The last record written. -1 (an invalid record) if there is none yet.
+static int last_record_;
+// How many more times last_record_ was repeated after it was written.
+static int repeats_;
+#endif
+
 // NOTE: The need to always pass the tracer array as argument
 // The pointer to the trace array cannot be stored as a static variable because
 // Vitis HLS does not support pointer to pointers. In essence, Vitis HLS cannot
@@ -41,16 +231,132 @@ static int buffer_wrapped_mask_;
 // arbitrary address, even if we store the address of the tracer array to the
 // static variable only once.
 
-// Initializes all five static variables. Only called exactly once at the
+// Initializes the static variables. Only called exactly once at the
 // beginning of the top-level function.
 void controlFlowTracerInit(int size);
-// Writes two integers to the trace array: row (line number) and column (column
-// number). Called at every trace record location. It has been observed that
-// the column number does not always make sense.
-void controlFlowTracerRecord(int *array, int row, int column);
-// Writes current_index_ and wrapped_ at the last two entries reserved in the
-// trace array. Called right before the return instruction of the top-level
-// function.
+// Writes the site ID to the trace array. Called at every trace record location.
+void controlFlowTracerRecord(int *array, int site);
+// Writes the trip count of the loop that is being exited. Called at the exit
+// blocks of loops when the pass runs in loops mode. The loop entry itself is
+// recorded with controlFlowTracerRecord.
+void controlFlowTracerRecordTrip(int *array, int trips);
+// Writes the ID of a completed Ball-Larus path. Called on loop back edges and
+// before returns when the pass runs in paths mode.
+void controlFlowTracerRecordPath(int *array, int path);
+// Shifts the outcome of a conditional branch (1 for the first successor) into
+// branch_bits_, and writes them as a branches record once they are full.
+// Called before every conditional branch in pipelined loops. Does nothing in
+// sampled builds, since the loop entry may not be sampled.
+void controlFlowTracerRecordBranch(int *array, int taken);
+// Writes the branch outcomes not written yet. Called at the exit blocks of
+// pipelined loops, and before function entry records in branches mode.
+void controlFlowTracerFlushBranches(int *array);
+// Writes a target record with the index of the successor a switch goes to,
+// after flushing the branch outcomes before it. Called before every switch in
+// branches mode.
+void controlFlowTracerRecordTarget(int *array, int target);
+// Writes a call record of the given call site. Called right before every call
+// to an instrumented function with -controlflowtrace-calls. Not sampled, so
+// that every sample has its calling context.
+void controlFlowTracerRecordCall(int *array, int call);
+// Writes a return record of the given call site. Called right after every call
+// to an instrumented function with -controlflowtrace-calls.
+void controlFlowTracerRecordReturn(int *array, int call);
+#ifdef CONTROL_FLOW_TRACER_PACKED
+// Packs a site record of the given width into the current word, and writes the
+// word once the next record would not fit. Replaces controlFlowTracerRecord
+// when site records are packed, and is inlined so that width is a constant.
+// Packed records bypass the RLE, sampling, trigger, and sync logic.
+void controlFlowTracerRecordPacked(int *array, int site, int width);
+#endif
+#ifdef CONTROL_FLOW_TRACER_HIERARCHICAL
+// Resets the detail level and marks the detail slice empty. Called right after
+// controlFlowTracerInitChannels with -controlflowtrace-hierarchical.
+void controlFlowTracerInitDetail(int *array);
+// Counts a coarse site record, and opens a detail window if one is due. Called
+// right before the site records other than basic block records with
+// -controlflowtrace-hierarchical.
+void controlFlowTracerOpenWindow(int *array, int site);
+// Writes a site record to the detail slice if a window is open. Replaces the
+// record calls of basic block sites with -controlflowtrace-hierarchical.
+void controlFlowTracerRecordDetail(int *array, int site);
+// Closes the open window, and writes the end record of the detail slice at its
+// cursor without advancing it. Called right before controlFlowTracerFinish
+// with -controlflowtrace-hierarchical.
+void controlFlowTracerFinishDetail(int *array);
+#endif
+#ifdef CONTROL_FLOW_TRACER_SIGNATURE
+// Resets the path signature. Replaces controlFlowTracerInit with
+// -controlflowtrace-signature.
+void controlFlowTracerInitSignature();
+// Folds a record with the given tag and payload into the path signature. The
+// payload saturates. Replaces the record, trip, path, call, return, branch, and
+// target calls with -controlflowtrace-signature, so nothing is stamped,
+// sampled, or masked by regions.
+void controlFlowTracerFold(int tag, int payload);
+// Writes the path signature and the number of records folded into it to the
+// first two entries of the trace array. Replaces controlFlowTracerFinish with
+// -controlflowtrace-signature.
+void controlFlowTracerFinishSignature(int *array);
+#endif
+// Sets the sample period, which must be a power of two. Called right after
+// controlFlowTracerInit when the top-level function has a sample period
+// argument. Does nothing unless built with CONTROL_FLOW_TRACER_SAMPLE_PERIOD.
+void controlFlowTracerSetSamplePeriod(int period);
+// Sets the enable mask. Called right after controlFlowTracerInit when the
+// top-level function has an enable argument.
+void controlFlowTracerEnable(int mask);
+// Enables or disables recording according to the bit of the given region in
+// the enable mask. Called at the entry of every instrumented function and
+// after every call to one, when the top-level function has an enable
+// argument.
+void controlFlowTracerEnter(int region);
+// Latches the clock without writing a record, so that the first cycle stamp
+// counts from here. Called right after controlFlowTracerInit when the
+// top-level function has a clock argument.
+void controlFlowTracerStartClock(int now);
+// Writes a time record with the cycles passed since the previous stamp. Called
+// right before the site and path records it stamps, and before
+// controlFlowTracerFinish.
+void controlFlowTracerStamp(int *array, int now);
+// Splits the trace data region into slices of slice entries, confines the
+// records outside of dataflow processes to the first slice, and resets the
+// given number of channels (none without CONTROL_FLOW_TRACER_CHANNELS).
+// Called right after controlFlowTracerInit when there are dataflow processes,
+// a site histogram, or a detail level.
+void controlFlowTracerInitChannels(int *array, int channels, int slice);
+#ifdef CONTROL_FLOW_TRACER_CHANNELS
+// Writes a record with the given tag and payload to the slice of a channel.
+// The payload saturates. Replaces the record, trip, and path calls in
+// dataflow processes.
+void controlFlowTracerChannelRecord(int *array, int channel, int slice, int tag, int payload);
+// Writes a time record to the slice of a channel. Replaces the stamp calls in
+// dataflow processes.
+void controlFlowTracerChannelStamp(int *array, int channel, int slice, int now);
+// Writes the end record of a channel at its cursor without advancing it.
+// Called right before the return instructions of dataflow processes.
+void controlFlowTracerChannelFinish(int *array, int channel, int slice);
+#endif
+#ifdef CONTROL_FLOW_TRACER_COUNTERS
+// Zeroes the first count counters. Called right after controlFlowTracerInit
+// when the pass runs in edges mode or with -controlflowtrace-histogram.
+void controlFlowTracerClearCounters(int count);
+// Increments a counter. Called on the counted edges in edges mode, and right
+// before every site record with -controlflowtrace-histogram.
+void controlFlowTracerCount(int counter);
+// Copies the first count edge counters to the start of the trace array and
+// sets current_index_ to count. Called right before controlFlowTracerFinish
+// in edges mode, whose trace array then holds counters instead of records.
+void controlFlowTracerFlushCounters(int *array, int count);
+// Copies the first count counters, which hold the hits of each site, to the
+// trace array starting at offset. Called right before controlFlowTracerFinish
+// with -controlflowtrace-histogram.
+void controlFlowTracerFlushHistogram(int *array, int offset, int count);
+#endif
+// Writes current_index_, wrapped_, and generated_ at the last four entries
+// reserved in the trace array. Any pending branch outcomes, partially packed word, pending
+// repeat count, and records still staged on chip are flushed first. Called
+// right before the return instruction of the top-level function.
 void controlFlowTracerFinish(int *array);
 
 #endif